@@ -2,10 +2,14 @@
 #define API_HPP
 
 #include "../request/request_handler.hpp"
+#include "../request/async_request_handler.hpp"
 #include "../request/request.hpp"
 #include "../request/postgres.hpp"
 #include "../request/middleware.hpp"
 #include "../parser/parser.hpp"
+#include "../parser/corpus.hpp"
+#include "../worker_pool.hpp"
+#include "../conditional.hpp"
 
 #include <boost/beast/http.hpp>
 #include <nlohmann/json.hpp>
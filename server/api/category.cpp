@@ -1,9 +1,16 @@
 #include "api.hpp"
 
 using namespace postgres;
-class CategoryHandler : public RequestHandler {
+class CategoryHandler : public AsyncRequestHandler {
   private:
-  
+  // categories are fetched a whole quiz at a time and come out of the corpus cache
+  static constexpr middleware::RateLimit RATE_LIMIT = middleware::make_rate_limit("/api/category", 20, 40);
+  static constexpr request::PermissionMask GET_PERMISSIONS = request::permission_mask(request::PERMISSION_CATEGORY_ADMIN);
+  static constexpr request::PermissionMask LIST_PERMISSIONS =
+    request::permission_mask(request::PERMISSION_SUPERUSER, request::PERMISSION_CATEGORY_ADMIN);
+  static constexpr request::PermissionMask PUT_PERMISSIONS = request::permission_mask(request::PERMISSION_CATEGORY_PUT);
+  static constexpr request::PermissionMask DELETE_PERMISSIONS = request::permission_mask(request::PERMISSION_CATEGORY_DELETE);
+
   struct Category {
     std::string category_name;
     int id;
@@ -22,12 +29,7 @@ class CategoryHandler : public RequestHandler {
   */
   int select_category(const std::string& category_name, int verbose) {
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_category", category_name);
-      txn.commit();
-      pool.release(c);
+      pqxx::result r = exec_prepared("select_category", category_name);
 
       if (r.empty()) {
         verbose && std::cout << "Category " << category_name << " not found" << std::endl;
@@ -35,6 +37,8 @@ class CategoryHandler : public RequestHandler {
       }
       verbose && std::cout << "Category " << category_name << " found" << std::endl;
       return r[0][0].as<int>();
+    } catch (const PoolTimeoutError&) {
+      throw;
     } catch (const std::exception &e) {
       verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
     }
@@ -52,12 +56,7 @@ class CategoryHandler : public RequestHandler {
    */
   CategoryData get_category_data(int limit, int offset, int verbose) {
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_category_names_pagington", limit, offset * limit);
-      txn.commit();
-      pool.release(c);
+      pqxx::result r = exec_prepared("select_category_names_pagington", limit, offset * limit);
 
       int count = r.size();
       if (count == 0)
@@ -77,6 +76,8 @@ class CategoryHandler : public RequestHandler {
       }
 
       return {categories.release(), count};
+    } catch (const PoolTimeoutError&) {
+      throw;
     } catch (const std::exception &e) {
       std::cerr << "Error executing query: " << e.what() << std::endl;
     } catch (...) {
@@ -93,16 +94,16 @@ class CategoryHandler : public RequestHandler {
   * @return 1 if the category was created, 0 otherwise.
   */
   int create_category(const char * category_name, int verbose) {
+    auto c = lease_connection("create_category");
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
       pqxx::work txn(*c);
       pqxx::result r = txn.exec_prepared("create_category", category_name);
       txn.commit();
-      pool.release(c);
+      c.release();
 
       if (!r.empty()) {
         verbose && std::cout << "Successfully created category " << category_name << std::endl;
+        server::invalidate_validators();
         return 1;
       } else {
         verbose && std::cerr << "Category " << category_name << " already exists" << std::endl;
@@ -123,16 +124,16 @@ class CategoryHandler : public RequestHandler {
   * @return 1 if the category was deleted, 0 otherwise.
   */
   int delete_category(const char * category_name, int verbose) {
+    auto c = lease_connection("delete_category");
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
       pqxx::work txn(*c);
       pqxx::result r = txn.exec_prepared("delete_category", category_name);
       txn.commit();
-      pool.release(c);
+      c.release();
 
       if (!r.empty()) {
         verbose && std::cout << "Successfully deleted category with name " << category_name << std::endl;
+        server::invalidate_validators();
         return 1;
       } else {
         verbose && std::cerr << "Category with name " << category_name << " does not exist" << std::endl;
@@ -151,21 +152,33 @@ class CategoryHandler : public RequestHandler {
    * used to fetch a single category by name.
    *
    * @param req HTTP request object.
-   * @param user_id ID of the user making the request.
+   * @param permissions Permissions of the user making the request.
    * @param category_name Name of the category to fetch.
    * @return HTTP response object.
    */
-  http::response<http::string_body> handle_single_category(const http::request<http::string_body>& req,
-    int user_id, const std::string& category_name) {
-    std::string* required_permissions = new std::string[1]{"category.admin"};
-    if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions, 1))
-      return request::make_unauthorized_response("Unauthorized", req);
-    delete[] required_permissions;
-
-    parser::Category cat = parser::parse_category("../questions/", category_name.c_str());
-    if (strncmp(cat.category, "NO_CATEGORY", 10) == 0)
-      return request::make_bad_request_response("Category not found", req);
-    return request::make_ok_request_response(parser::fetch_category(cat).dump(), req);
+  net::awaitable<http::response<http::string_body>> handle_single_category(const http::request<http::string_body>& req,
+    const request::PermissionMask& permissions, const std::string& category_name) {
+    auto& workers = server::get_worker_pool();
+    if (!middleware::check_permissions(permissions, GET_PERMISSIONS))
+      co_return request::make_unauthorized_response("Unauthorized", req);
+    if (auto not_modified = server::check_not_modified(req))
+      co_return std::move(*not_modified);
+
+    const parser::MappedCategory* cat = parser::find_category(category_name);
+    if (!cat)
+      co_return request::make_bad_request_response("Category not found", req);
+    request::ContentEncoding encoding = request::negotiate_encoding(
+      std::string_view(req[http::field::accept_encoding].data(), req[http::field::accept_encoding].size()));
+    // the first request for a category in an encoding writes and compresses it, keep that off the I/O thread
+    const std::string* body = parser::find_category_response(*cat, encoding);
+    if (!body)
+      body = co_await workers.run([cat, &encoding] { return &parser::get_category_response(*cat, encoding); });
+    http::response<http::string_body> res = request::make_ok_body_response(*body, req);
+    res.set(http::field::etag, server::format_etag(parser::get_category_hash(*cat)));
+    request::set_content_encoding(res, encoding);
+    if (encoding != request::ENCODING_IDENTITY)
+      request::record_precompressed();
+    co_return res;
   }
 
   /**
@@ -173,38 +186,41 @@ class CategoryHandler : public RequestHandler {
    * list all categories for use in the admin panel.
    * 
    * @param req HTTP request object.
-   * @param user_id ID of the user making the request.
+   * @param permissions Permissions of the user making the request.
    * @param page_size Number of categories to fetch.
    * @param offset Offset to start fetching categories from.
    * @return HTTP response object.
    */
-  http::response<http::string_body> handle_category_list(const http::request<http::string_body>& req, int user_id,
-    const std::string& page_size, const std::optional<std::string>& offset) {
-    std::string* required_permissions = new std::string[2]{"superuser", "category.admin"};
-    if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions, 2))
-      return request::make_unauthorized_response("Unauthorized", req);
-    delete[] required_permissions;
+  net::awaitable<http::response<http::string_body>> handle_category_list(const http::request<http::string_body>& req,
+    const request::PermissionMask& permissions, const std::string& page_size, const std::optional<std::string>& offset) {
+    auto& workers = server::get_worker_pool();
+    if (!middleware::check_permissions(permissions, LIST_PERMISSIONS))
+      co_return request::make_unauthorized_response("Unauthorized", req);
+    if (auto not_modified = server::check_not_modified(req))
+      co_return std::move(*not_modified);
 
     int pages_int, offset_int = 0;
     if (offset.has_value() && !validate_pagination_params(page_size, offset.value(), pages_int, offset_int)) {
-      return request::make_bad_request_response("Invalid request: 'page_size|page' invalid.", req);
+      co_return request::make_bad_request_response("Invalid request: 'page_size|page' invalid.", req);
     }
 
     if (!offset.has_value()) {
       try {
         pages_int = std::stoi(page_size);
       } catch (...) {
-        return request::make_bad_request_response("Invalid request: 'page_size' must be an integer.", req);
+        co_return request::make_bad_request_response("Invalid request: 'page_size' must be an integer.", req);
       }
     }
 
     nlohmann::json response_json;
-    CategoryData category_data = get_category_data(pages_int, offset_int, 0);
+    CategoryData category_data = co_await workers.run([this, pages_int, offset_int] {
+      return get_category_data(pages_int, offset_int, 0);
+    });
     
     if (category_data.count == 0) {
       response_json["message"] = "No categories found";
       response_json["categories"] = nlohmann::json::array();
-      return request::make_ok_request_response(response_json.dump(4), req);
+      co_return request::make_ok_response(response_json, req);
     }
 
     response_json["message"] = "Categories fetched successfully";
@@ -218,7 +234,7 @@ class CategoryHandler : public RequestHandler {
     }
 
     delete[] category_data.categories;
-    return request::make_ok_request_response(response_json.dump(4), req);
+    co_return request::make_ok_response(response_json, req);
   }
 
   /**
@@ -246,16 +262,26 @@ class CategoryHandler : public RequestHandler {
     return "/api/category";
   }
 
-  http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) {  
-    if (middleware::rate_limited(ip_address))
-      return request::make_too_many_requests_response("Too many requests", req);
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::get, http::verb::put, http::verb::delete_};
+  }
+
+  int is_cacheable() const override {
+    return 1;
+  }
+
+  net::awaitable<http::response<http::string_body>> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) override {
+    if (middleware::rate_limited(ip_address, RATE_LIMIT))
+      co_return request::make_too_many_requests_response("Too many requests", req);
 
+    auto& workers = server::get_worker_pool();
     std::string_view session_id = request::get_session_id_from_cookie(req);
-    int user_id = request::select_user_data_from_session(session_id, 0).user_id;
+    // every branch checks permissions, so they are read in the same round trip as the session
+    request::PermissionMask permissions = (co_await request::async_select_authorized_user(std::string(session_id), 0)).permissions;
     if (req.method() == http::verb::get) {
       std::optional<std::string> category_opt = request::parse_from_request(req, "category_name");
       if (category_opt.has_value()) {
-        return handle_single_category(req, user_id, category_opt.value());
+        co_return co_await handle_single_category(req, permissions, category_opt.value());
       }
 
       std::optional<std::string> superuser_opt = request::parse_from_request(req, "superuser");
@@ -263,67 +289,66 @@ class CategoryHandler : public RequestHandler {
       std::optional<std::string> offset_opt = request::parse_from_request(req, "page");
 
       if (!superuser_opt.has_value() || superuser_opt.value() != "true")
-        return request::make_bad_request_response("Endpoint not implemented", req);
+        co_return request::make_bad_request_response("Endpoint not implemented", req);
       if (!pages_opt.has_value())
-        return request::make_bad_request_response("Invalid request: Missing required field (page_size).", req);
-      return handle_category_list(req, user_id, pages_opt.value(), offset_opt);
+        co_return request::make_bad_request_response("Invalid request: Missing required field (page_size).", req);
+      co_return co_await handle_category_list(req, permissions, pages_opt.value(), offset_opt);
     } else if (req.method() == http::verb::put) {
       /**
         * -------------- PUT NEW CATEGORY --------------
         */
 
-      std::string * required_permissions = new std::string[1]{"category.put"};
-      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions, 1))
-        return request::make_unauthorized_response("Unauthorized", req);
+      if (!middleware::check_permissions(permissions, PUT_PERMISSIONS))
+        co_return request::make_unauthorized_response("Unauthorized", req);
 
       auto json_request = nlohmann::json::object();
       try {
         json_request = nlohmann::json::parse(req.body());
       } catch (const nlohmann::json::parse_error& e) {
-        return request::make_bad_request_response("Invalid JSON request", req);
+        co_return request::make_bad_request_response("Invalid JSON request", req);
       }
 
       if (!json_request.contains("category_name")) {
-        return request::make_bad_request_response("Invalid request: Missing required field (category_name).", req);
+        co_return request::make_bad_request_response("Invalid request: Missing required field (category_name).", req);
       }
 
       nlohmann::json response_json;
-      if (!(create_category(json_request["category_name"].get<std::string>().c_str(), 0))) {
-        return request::make_bad_request_response("Category already exists", req);
+      std::string category_name = json_request["category_name"].get<std::string>();
+      if (!(co_await workers.run([this, &category_name] { return create_category(category_name.c_str(), 0); }))) {
+        co_return request::make_bad_request_response("Category already exists", req);
       }
 
       response_json["message"] = "Category created successfully";
       response_json["category"] = json_request["category_name"];
-      return request::make_ok_request_response(response_json.dump(4), req);
+      co_return request::make_ok_response(response_json, req);
     } else if (req.method() == http::verb::delete_) {
       /**
         * -------------- DELETE CATEGORY --------------
         */
 
-      std::string * required_permissions = new std::string[1]{"category.delete"};
-      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions, 1))
-        return request::make_unauthorized_response("Unauthorized", req);
+      if (!middleware::check_permissions(permissions, DELETE_PERMISSIONS))
+        co_return request::make_unauthorized_response("Unauthorized", req);
 
       auto category_opt = request::parse_from_request(req, "category_name");
       if (!category_opt) {
-        return request::make_bad_request_response("Invalid category parameters", req);
+        co_return request::make_bad_request_response("Invalid category parameters", req);
       }
 
       std::string category = *category_opt;
       nlohmann::json response_json;
-      if (delete_category(category.c_str(), 1)) {
+      if (co_await workers.run([this, &category] { return delete_category(category.c_str(), 1); })) {
         response_json["message"] = "Category deleted successfully";
         response_json["category_name"] = category;
-        return request::make_ok_request_response(response_json.dump(4), req);
+        co_return request::make_ok_response(response_json, req);
       } else {
-        return request::make_bad_request_response("Category not found", req);
+        co_return request::make_bad_request_response("Category not found", req);
       }
     } else {
-      return request::make_bad_request_response("Invalid method", req);
+      co_return request::make_bad_request_response("Invalid method", req);
     }
   }
 };
 
-extern "C" RequestHandler* create_category_handler() {
+extern "C" AsyncRequestHandler* create_category_async_handler() {
   return new CategoryHandler();
 }
\ No newline at end of file
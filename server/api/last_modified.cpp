@@ -14,13 +14,13 @@ class LastModifiedHandler : public RequestHandler {
    * @return Last modified date of the table if found, "" otherwise.
    */
   std::string select_last_modified(const std::string& table_name, int verbose) {
+    auto& pool = get_connection_pool();
+    auto c = pool.lease();
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
       pqxx::work txn(*c);
       std::string last_modified = txn.query_value<std::string>(build_query(table_name));
       txn.commit();
-      pool.release(c);
+      c.release();
       
       if (last_modified.empty()) {
         verbose && std::cerr << "Table " << table_name << " not found" << std::endl;
@@ -38,6 +38,14 @@ class LastModifiedHandler : public RequestHandler {
     return "/api/last_modified";
   }
 
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::get};
+  }
+
+  int is_cacheable() const override {
+    return 1;
+  }
+
   http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) {
     if (middleware::rate_limited(ip_address))
       return request::make_too_many_requests_response("Too many requests", req);
@@ -56,9 +64,15 @@ class LastModifiedHandler : public RequestHandler {
       }
 
       auto& table = table_opt.value();
-      std::string * required_permissions = new std::string[1]{table + ".admin"};
-      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions, 1))
+      // the permission depends on the table, so its mask can only be built at request time
+      request::PermissionMask required_permissions;
+      int permission_id = request::find_permission(table + ".admin");
+      if (permission_id >= 0)
+        required_permissions.set(permission_id);
+      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions))
         return request::make_unauthorized_response("Unauthorized", req);
+      if (auto not_modified = server::check_not_modified(req))
+        return std::move(*not_modified);
 
       std::string last_modified = select_last_modified(table, 0);
       if (last_modified.empty()) {
@@ -68,7 +82,7 @@ class LastModifiedHandler : public RequestHandler {
       nlohmann::json response_json;
       response_json["message"] = "Last modified date found successfully";
       response_json["last_modified"] = last_modified;
-      return request::make_ok_request_response(response_json.dump(4), req);
+      return request::make_ok_response(response_json, req);
     } else {
       return request::make_bad_request_response("Invalid method", req);
     }
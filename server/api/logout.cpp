@@ -14,18 +14,22 @@ class LogoutHandler : public RequestHandler {
    */
   int select_user_id_from_session(std::string_view session_id, int verbose) {
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_user_id_from_session", session_id);
-      txn.commit();
-      pool.release(c);
-      
+      pqxx::result r = exec_prepared("select_user_id_from_session", session_id);
+
+      // a replica may not have replayed a session created moments ago, only the primary can turn it down
+      if (r.empty() && has_replicas()) {
+        auto primary = get_connection_pool().lease();
+        pqxx::nontransaction confirm(*primary);
+        r = confirm.exec_prepared("select_user_id_from_session", session_id);
+      }
+
       if (r.empty()) {
         verbose && std::cerr << "Session ID " << session_id << " not found" << std::endl;
         return -1;
       }
       return r[0][0].as<int>();
+    } catch (const PoolTimeoutError&) {
+      throw;
     } catch (const std::exception &e) {
       verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
     } catch (...) {
@@ -39,6 +43,10 @@ class LogoutHandler : public RequestHandler {
     return "/api/logout";
   }
 
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::post};
+  }
+
   http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address){
     if (req.method() == http::verb::post) {
       /**
@@ -64,9 +72,10 @@ class LogoutHandler : public RequestHandler {
         return request::make_unauthorized_response("Session id does not match user id!", req);
 
       request::invalidate_session(session_id, 0);
+      request::invalidate_user_permissions(user_id);
       nlohmann::json response_json;
       response_json["message"] = "Logout successful";
-      return request::make_ok_request_response(response_json.dump(4), req);
+      return request::make_ok_response(response_json, req);
     } else {
       return request::make_bad_request_response("Invalid request method", req);
     }
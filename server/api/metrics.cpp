@@ -0,0 +1,254 @@
+#include "api.hpp"
+
+class MetricsHandler : public RequestHandler {
+  private:
+  static constexpr middleware::RateLimit RATE_LIMIT = middleware::make_rate_limit("/api/metrics", 1, 5);
+  static constexpr request::PermissionMask REQUIRED_PERMISSIONS = request::permission_mask(request::PERMISSION_SUPERUSER);
+
+  /**
+   * Build the statistics of a worker pool: the one that runs request handlers or the one that verifies passwords.
+   * @param pool Pool to report on.
+   * @return JSON object with the pool's queue, wait time and run time statistics.
+   */
+  nlohmann::json get_worker_pool_metrics(server::WorkerPool& pool) {
+    server::WorkerPoolStats stats = pool.get_stats();
+    nlohmann::json metrics;
+    metrics["threads"] = stats.threads;
+    metrics["capacity"] = stats.capacity;
+    metrics["queue_depth"] = stats.queue_depth;
+    metrics["submitted"] = stats.submitted;
+    metrics["rejected"] = stats.rejected;
+    metrics["completed"] = stats.completed;
+    metrics["total_wait_us"] = stats.total_wait_us;
+    metrics["max_wait_us"] = stats.max_wait_us;
+    metrics["average_wait_us"] = stats.submitted ? stats.total_wait_us / stats.submitted : 0;
+    metrics["total_run_us"] = stats.total_run_us;
+    metrics["max_run_us"] = stats.max_run_us;
+    metrics["average_run_us"] = stats.completed ? stats.total_run_us / stats.completed : 0;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of response compression.
+   * @return JSON object with the compression statistics.
+   */
+  nlohmann::json get_compression_metrics() {
+    request::CompressionStats stats = request::get_compression_stats();
+    nlohmann::json metrics;
+    metrics["compressed"] = stats.compressed;
+    metrics["precompressed"] = stats.precompressed;
+    metrics["skipped"] = stats.skipped;
+    metrics["bytes_in"] = stats.bytes_in;
+    metrics["bytes_out"] = stats.bytes_out;
+    metrics["ratio"] = stats.bytes_in ? (double) stats.bytes_out / stats.bytes_in : 1.0;
+    metrics["cpu_us"] = stats.cpu_us;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of conditional GETs.
+   * @return JSON object with the conditional request statistics.
+   */
+  nlohmann::json get_conditional_metrics() {
+    server::ValidatorStats stats = server::get_validator_stats();
+    nlohmann::json metrics;
+    metrics["validators"] = stats.entries;
+    metrics["generation"] = stats.generation;
+    metrics["stored"] = stats.stored;
+    metrics["not_modified"] = stats.not_modified;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of the session cache and of the lookups it saved.
+   * @return JSON object with the session cache statistics.
+   */
+  nlohmann::json get_session_cache_metrics() {
+    request::SessionCacheStats stats = request::get_session_cache().get_stats();
+    nlohmann::json metrics;
+    metrics["entries"] = stats.entries;
+    metrics["capacity"] = stats.capacity;
+    metrics["shards"] = stats.shards;
+    metrics["hits"] = stats.hits;
+    metrics["misses"] = stats.misses;
+    metrics["expired"] = stats.expired;
+    metrics["evicted"] = stats.evicted;
+    metrics["hit_rate"] = stats.hits + stats.misses ? (double) stats.hits / (stats.hits + stats.misses) : 0.0;
+
+    request::SessionLookupStats lookups = request::get_session_lookup_stats();
+    metrics["invalid_entries"] = request::get_invalid_session_cache().get_stats().entries;
+    metrics["empty_skipped"] = lookups.empty;
+    metrics["malformed_skipped"] = lookups.malformed;
+    metrics["known_invalid_skipped"] = lookups.known_invalid;
+    metrics["database_lookups"] = lookups.database;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of the session writer.
+   * @return JSON object with the session writer statistics.
+   */
+  nlohmann::json get_session_writer_metrics() {
+    request::SessionWriterStats stats = request::get_session_writer().get_stats();
+    nlohmann::json metrics;
+    metrics["created"] = stats.created;
+    metrics["invalidated"] = stats.invalidated;
+    metrics["coalesced"] = stats.coalesced;
+    metrics["flushes"] = stats.flushes;
+    metrics["failed"] = stats.failed;
+    metrics["rejected"] = stats.rejected;
+    metrics["pending"] = stats.pending;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of the synchronous connection pool.
+   * @return JSON object with the connection pool statistics.
+   */
+  nlohmann::json get_pool_metrics() {
+    postgres::ConnectionPoolStats stats = postgres::get_connection_pool().get_stats();
+    nlohmann::json metrics;
+    metrics["size"] = stats.size;
+    metrics["idle"] = stats.idle;
+    metrics["in_use"] = stats.in_use;
+    metrics["waiting"] = stats.waiting;
+    metrics["min_size"] = stats.min_size;
+    metrics["max_size"] = stats.max_size;
+    metrics["utilization"] = stats.max_size ? (double)stats.in_use / stats.max_size : 0.0;
+    metrics["acquired"] = stats.acquired;
+    metrics["timeouts"] = stats.timeouts;
+    metrics["created"] = stats.created;
+    metrics["closed"] = stats.closed;
+    metrics["failed_checks"] = stats.failed_checks;
+    metrics["wait_us_total"] = stats.wait_us;
+    metrics["wait_us_max"] = stats.max_wait_us;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of the read replica pools.
+   * @return JSON object with the replica statistics, null if no replicas are configured.
+   */
+  nlohmann::json get_replica_metrics() {
+    nlohmann::json metrics;
+    if (!postgres::has_replicas())
+      return metrics;
+
+    metrics["available"] = postgres::replicas_available() == 1;
+    metrics["fallbacks"] = postgres::get_replica_fallbacks();
+    postgres::ConnectionPool* pool = postgres::get_replica_connection_pool();
+    if (pool) {
+      postgres::ConnectionPoolStats stats = pool->get_stats();
+      metrics["pool"]["size"] = stats.size;
+      metrics["pool"]["in_use"] = stats.in_use;
+      metrics["pool"]["acquired"] = stats.acquired;
+      metrics["pool"]["timeouts"] = stats.timeouts;
+    }
+    postgres::AsyncConnectionPool* async_pool = postgres::get_async_replica_pool();
+    if (async_pool) {
+      postgres::AsyncPoolStats stats = async_pool->get_stats();
+      metrics["async_pool"]["size"] = stats.size;
+      metrics["async_pool"]["queries"] = stats.queries;
+      metrics["async_pool"]["failed"] = stats.failed;
+      metrics["async_pool"]["reconnects"] = stats.reconnects;
+      metrics["async_pool"]["query_timeouts"] = stats.query_timeouts;
+    }
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of the asynchronous connection pool.
+   * @return JSON object with the connection pool statistics.
+   */
+  nlohmann::json get_async_pool_metrics() {
+    postgres::AsyncPoolStats stats = postgres::get_async_connection_pool().get_stats();
+    nlohmann::json metrics;
+    metrics["size"] = stats.size;
+    metrics["idle"] = stats.idle;
+    metrics["waiting"] = stats.waiting;
+    metrics["queries"] = stats.queries;
+    metrics["failed"] = stats.failed;
+    metrics["reconnects"] = stats.reconnects;
+    metrics["pipelines"] = stats.pipelines;
+    metrics["round_trips"] = stats.round_trips;
+    metrics["acquire_timeouts"] = stats.acquire_timeouts;
+    metrics["query_timeouts"] = stats.query_timeouts;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of the rate limiter.
+   * @return JSON object with the rate limiter statistics.
+   */
+  nlohmann::json get_rate_limiter_metrics() {
+    middleware::RateLimiterStats stats = middleware::get_rate_limiter().get_stats();
+    nlohmann::json metrics;
+    metrics["entries"] = stats.entries;
+    metrics["capacity"] = stats.capacity;
+    metrics["allowed"] = stats.allowed;
+    metrics["limited"] = stats.limited;
+    metrics["expired"] = stats.expired;
+    metrics["evicted"] = stats.evicted;
+    return metrics;
+  }
+
+  /**
+   * Build the statistics of the permission cache.
+   * @return JSON object with the permission cache statistics.
+   */
+  nlohmann::json get_permission_metrics() {
+    request::PermissionCacheStats stats = request::get_permission_cache_stats();
+    nlohmann::json metrics;
+    metrics["entries"] = stats.entries;
+    metrics["interned"] = stats.interned;
+    metrics["hits"] = stats.hits;
+    metrics["misses"] = stats.misses;
+    return metrics;
+  }
+
+  public:
+  std::string get_endpoint() const override {
+    return "/api/metrics";
+  }
+
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::get};
+  }
+
+  http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) {
+    if (middleware::rate_limited(ip_address, RATE_LIMIT))
+      return request::make_too_many_requests_response("Too many requests", req);
+
+    std::string_view session_id = request::get_session_id_from_cookie(req);
+    int user_id = request::select_user_data_from_session(session_id, 0).user_id;
+    if (req.method() == http::verb::get) {
+      /**
+       * -------------- GET METRICS --------------
+       */
+
+      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), REQUIRED_PERMISSIONS))
+        return request::make_unauthorized_response("Unauthorized", req);
+
+      nlohmann::json response_json;
+      response_json["message"] = "Metrics fetched successfully";
+      response_json["worker_pool"] = get_worker_pool_metrics(server::get_worker_pool());
+      response_json["password_pool"] = get_worker_pool_metrics(server::get_password_pool());
+      response_json["compression"] = get_compression_metrics();
+      response_json["conditional"] = get_conditional_metrics();
+      response_json["session_cache"] = get_session_cache_metrics();
+      response_json["permissions"] = get_permission_metrics();
+      response_json["rate_limiter"] = get_rate_limiter_metrics();
+      response_json["session_writer"] = get_session_writer_metrics();
+      response_json["pool"] = get_pool_metrics();
+      response_json["async_pool"] = get_async_pool_metrics();
+      response_json["replicas"] = get_replica_metrics();
+      return request::make_ok_response(response_json, req);
+    } else {
+      return request::make_bad_request_response("Invalid method", req);
+    }
+  }
+};
+
+extern "C" RequestHandler* create_metrics_handler() {
+  return new MetricsHandler();
+}
\ No newline at end of file
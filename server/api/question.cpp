@@ -3,7 +3,9 @@
 using namespace postgres;
 class QuestionHandler : public RequestHandler {
   private:
-  
+  static constexpr request::PermissionMask PUT_PERMISSIONS = request::permission_mask(request::PERMISSION_QUESTION_PUT);
+  static constexpr request::PermissionMask DELETE_PERMISSIONS = request::permission_mask(request::PERMISSION_QUESTION_DELETE);
+
   /**
    * Select a question by ID from the database.
    * @param question_id ID of the question to select.
@@ -12,12 +14,7 @@ class QuestionHandler : public RequestHandler {
    */
   int select_question(int question_id, int verbose) {
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_question", question_id);
-      txn.commit();
-      pool.release(c);
+      pqxx::result r = exec_prepared("select_question", question_id);
 
       if (r.empty()) {
         std::cout << "Question with ID " << question_id << " not found" << std::endl;
@@ -25,6 +22,8 @@ class QuestionHandler : public RequestHandler {
       }
       verbose && std::cout << "Question with ID " << question_id << " found" << std::endl;
       return r[0][0].as<int>();
+    } catch (const PoolTimeoutError&) {
+      throw;
     } catch (const std::exception &e) {
       verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
     } catch (...) {
@@ -44,15 +43,15 @@ class QuestionHandler : public RequestHandler {
    */
   int create_question(const char * question, std::vector<std::string> answers,
     int correct_answer, int category_id, int verbose) {
+    auto c = lease_connection("create_question");
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
       pqxx::work txn(*c);
       pqxx::result r = txn.exec_prepared("create_question", question, answers, correct_answer, category_id);
       txn.commit();
-      pool.release(c);
+      c.release();
 
       verbose && std::cout << "Successfully created question " << question << std::endl;
+      server::invalidate_validators();
       return 1;
     } catch (const std::exception &e) {
       verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
@@ -69,16 +68,16 @@ class QuestionHandler : public RequestHandler {
    * @return 1 if the question was deleted, 0 otherwise.
    */
   int delete_question(int question_id, int verbose) {
+    auto c = lease_connection("delete_question");
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
       pqxx::work txn(*c);
       pqxx::result r = txn.exec_prepared("delete_question", question_id);
       txn.commit();
-      pool.release(c);
+      c.release();
 
       if (!r.empty()) {
         verbose && std::cout << "Successfully deleted question with ID " << question_id << std::endl;
+        server::invalidate_validators();
         return 1;
       } else {
         verbose && std::cerr << "Question with ID " << question_id << " does not exist" << std::endl;
@@ -97,6 +96,10 @@ class QuestionHandler : public RequestHandler {
     return "/api/question";
   }
 
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::get, http::verb::put, http::verb::delete_};
+  }
+
   http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) {
     if (middleware::rate_limited(ip_address))
       return request::make_too_many_requests_response("Too many requests", req);
@@ -127,7 +130,7 @@ class QuestionHandler : public RequestHandler {
       if (select_question(question_id, 0)) {
         response_json["message"] = "Question found successfully";
         response_json["question"] = question;
-        return request::make_ok_request_response(response_json.dump(4), req);
+        return request::make_ok_response(response_json, req);
       } else {
         return request::make_bad_request_response("Question not found", req);
       }
@@ -136,8 +139,7 @@ class QuestionHandler : public RequestHandler {
         * -------------- PUT NEW QUESTION --------------
         */
 
-      std::string * required_permissions = new std::string[1]{"question.put"};
-      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions, 1))
+      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), PUT_PERMISSIONS))
         return request::make_unauthorized_response("Unauthorized", req);
 
       auto json_request = nlohmann::json::object();
@@ -168,14 +170,13 @@ class QuestionHandler : public RequestHandler {
 
       response_json["message"] = "Question created successfully";
       response_json["question"] = json_request["question"];
-      return request::make_ok_request_response(response_json.dump(4), req);
+      return request::make_ok_response(response_json, req);
     } else if (req.method() == http::verb::delete_) {
       /**
         * -------------- DELETE QUESTION --------------
         */
 
-      std::string * required_permissions = new std::string[1]{"question.delete"};
-      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), required_permissions, 1))
+      if (!middleware::check_permissions(request::get_user_permissions(user_id, 0), DELETE_PERMISSIONS))
         return request::make_unauthorized_response("Unauthorized", req);
 
       auto question_opt = request::parse_from_request(req, "question_id");
@@ -197,7 +198,7 @@ class QuestionHandler : public RequestHandler {
 
       if (delete_question(question_id, 0)) {
         response_json["message"] = "Question deleted successfully";
-        return request::make_ok_request_response(response_json.dump(4), req);
+        return request::make_ok_response(response_json, req);
       } else {
         return request::make_bad_request_response("Question not found", req);
       }
@@ -2,13 +2,20 @@
 #include <time.h>
 
 using namespace postgres;
-class SessionHandler : public RequestHandler {
+class SessionHandler : public AsyncRequestHandler {
+  private:
+  static constexpr request::PermissionMask SUPERUSER_PERMISSIONS = request::permission_mask(request::PERMISSION_SUPERUSER);
+
   public:
   std::string get_endpoint() const override{
     return "/api/session";
   }
 
-  http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) {
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::get};
+  }
+
+  net::awaitable<http::response<http::string_body>> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) override {
     if (req.method() == http::verb::get) {
       /**
        * -------------- VALIDATE SESSION --------------
@@ -16,38 +23,42 @@ class SessionHandler : public RequestHandler {
 
       std::string_view session_id = request::get_session_id_from_cookie(req);
       if (session_id.empty())
-        return request::make_unauthorized_response("Invalid or expired session", req);
-
-      request::UserData user_data = request::select_user_data_from_session(session_id, 0);
-      if (user_data.user_id == -1)
-        return request::make_unauthorized_response("Invalid or expired session", req);
+        co_return request::make_unauthorized_response("Invalid or expired session", req);
 
       std::optional<std::string> superuser_opt = request::parse_from_request(req, "superuser");
       nlohmann::json response_json;
 
       if (!superuser_opt.has_value() || (superuser_opt.has_value() && superuser_opt.value() != "true")) {
+        request::UserData user_data = co_await request::async_select_user_data_from_session(std::string(session_id), 0);
+        if (user_data.user_id == -1)
+          co_return request::make_unauthorized_response("Invalid or expired session", req);
+
         response_json["message"] = "Session validated successfully";
         response_json["user_id"] = user_data.user_id;
         response_json["username"] = user_data.username;
-        return request::make_ok_request_response(response_json.dump(4), req);
+        co_return request::make_ok_response(response_json, req);
       }
 
-      std::string * required_permissions = new std::string[1]{"superuser"};
-      if (!middleware::check_permissions(request::get_user_permissions(user_data.user_id, 0), required_permissions, 1))
-        return request::make_unauthorized_response("Unauthorized", req);
+      // session and permissions come back from the same round trip
+      request::AuthorizedUser authorized = co_await request::async_select_authorized_user(std::string(session_id), 0);
+      const request::UserData& user_data = authorized.user;
+      if (user_data.user_id == -1)
+        co_return request::make_unauthorized_response("Invalid or expired session", req);
+      if (!middleware::check_permissions(authorized.permissions, SUPERUSER_PERMISSIONS))
+        co_return request::make_unauthorized_response("Unauthorized", req);
         
       // allow user to access admin panel
       response_json["message"] = "Session validated successfully";
       response_json["user_id"] = user_data.user_id;
       response_json["username"] = user_data.username;
       response_json["superuser"] = true;
-      return request::make_ok_request_response(response_json.dump(4), req);
+      co_return request::make_ok_response(response_json, req);
     } else {
-      return request::make_bad_request_response("Invalid request method", req);
+      co_return request::make_bad_request_response("Invalid request method", req);
     }
   }
 };
 
-extern "C" RequestHandler* create_session_handler() {
+extern "C" AsyncRequestHandler* create_session_async_handler() {
   return new SessionHandler();
 }
\ No newline at end of file
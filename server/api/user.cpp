@@ -1,7 +1,7 @@
 #include "category.hpp"
 
 using namespace postgres;
-class UserHandler : public RequestHandler {
+class UserHandler : public AsyncRequestHandler {
   private:
   
   /**
@@ -29,19 +29,19 @@ class UserHandler : public RequestHandler {
    * - Max-Age=86400: The cookie expires after 24 hours.
    *
    * @param session_id Session ID to set in the cookie.
+   * @param req Login request being responded to.
    * @return HTTP response with the session cookie set.
    */
-  http::response<http::string_body> set_session_cookie(const std::string& session_id) {
-    http::response<http::string_body> res{http::status::ok, 11};
-    res.set(http::field::content_type, "application/json");
+  http::response<http::string_body> set_session_cookie(const std::string& session_id, const http::request<http::string_body>& req) {
+    http::response<http::string_body> res = request::make_ok_response("Login successful", req);
     res.set(http::field::set_cookie, "sessionId=" + session_id + "; HttpOnly; Secure; SameSite=None; Max-Age=86400");
-    res.body() = R"({"message": "Login successful", "status": "ok"})";
-    res.prepare_payload();
     return res;
   }
 
   /**
-   * Set a session ID for a user.
+   * Set a session ID for a user. The session is written by the session writer along with any
+   * other logins queued at the same time, and this returns once it is committed.
+   *
    * @param session_id Session ID to set.
    * @param user_id ID of the user to set the session ID for.
    * @param username Username of the user to set the session ID for.
@@ -50,124 +50,63 @@ class UserHandler : public RequestHandler {
    * @param verbose Whether to print messages to stdout.
    * @return 1 if the session ID was set, 0 otherwise.
    */
-  int set_session_id(std::string session_id, int user_id, std::string username, int duration, std::string ip_address, int verbose) {
-    try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      txn.exec_prepared("set_session_id", session_id, user_id, username, duration, ip_address);
-      txn.commit();
-      pool.release(c);
-
-      return 1;
-    } catch (const std:: exception &e) {
-      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
-    } catch (...) {
-      verbose && std::cerr << "Unknown error while executing query" << std::endl;
-    }
-    return 0;
-  }
-
-  /**
-   * Select the ID of a user by username.
-   * @param username Username of the user to select.
-   * @param verbose Whether to print messages to stdout.
-   * @return ID of the user if found, -1 otherwise.
-   */
-  int select_user_id(const char * username, int verbose) {
-    try{
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_user_id", username);
-      txn.commit();
-      pool.release(c);
-
-      if (r.empty()) {
-        verbose && std::cout << "User with username " << username << " not found" << std::endl;
-        return -1;
-      }
-      return r[0][0].as<int>();
-    } catch (const std:: exception &e) {
-      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
-    } catch (...) {
-      verbose && std::cerr << "Unknown error while executing query" << std::endl;
-    }
-    return -1;
+  net::awaitable<int> set_session_id(std::string session_id, int user_id, std::string username, int duration, std::string ip_address, int verbose) {
+    request::SessionRecord record{std::move(session_id), user_id, std::move(username), duration, std::move(ip_address)};
+    co_return co_await request::async_create_session(std::move(record), verbose);
   }
 
-
   /**
    * Select a user by ID.
    * @param id ID of the user to select.
    * @param verbose Whether to print messages to stdout.
-   * @return Username of the user if found, NULL otherwise.
+   * @return Username of the user if found, "" otherwise.
    */
-  std::string select_username_from_id(int id, int verbose) {
-    try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_username_from_id", id);
-      txn.commit();
-      pool.release(c);
-
-      if (r.empty()) {
-        verbose && std::cout << "User with ID " << id << " not found" << std::endl;
-        return NULL; 
-      }
-      return r[0][0].c_str();
-    } catch (const std:: exception &e) {
-      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
-    } catch (...) {
-      verbose && std::cerr << "Unknown error while executing query" << std::endl;
+  net::awaitable<std::string> select_username_from_id(int id, int verbose) {
+    QueryResult r = co_await async_query("select_username_from_id", std::vector<std::string>(1, std::to_string(id)));
+    if (!r.ok()) {
+      verbose && std::cerr << "Error executing query: " << r.error_message() << std::endl;
+      co_return "";
     }
-    return NULL;
-  }
-
-  /**
-   * Select the password of a user by username.
-   * @param username Username of the user to select.
-   * @param verbose Whether to print messages to stdout.
-   * @return (Hashed) password of the user if found, NULL otherwise.
-   */
-  const char * select_password(const char * username, int verbose) {
-    try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_password", username);
-      txn.commit();
-      pool.release(c);
-
-      if (r.empty()) {
-        verbose && std::cout << "User with username " << username << " not found" << std::endl;
-        return NULL;
-      }
-      return r[0][0].c_str();
-    } catch (const std:: exception &e) {
-      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
-    } catch (...) {
-      verbose && std::cerr << "Unknown error while executing query" << std::endl;
+    if (r.rows() == 0) {
+      verbose && std::cout << "User with ID " << id << " not found" << std::endl;
+      co_return "";
     }
-    return NULL;
+    co_return std::string(r.get(0, 0));
   }
 
   /**
-   * Authenticate a user with a username and password.
-   * This function uses BCrypt to validate the password against the hashed password stored in the database.
+   * Authenticate a user with a username and password. The user's ID and stored hash are fetched
+   * with one query, then BCrypt validates the password against the hash on the password pool so
+   * neither the event loop nor the request workers are held up by it.
    *
    * @param username Username of the user to authenticate.
    * @param password Password of the user to authenticate.
    * @param verbose Whether to print messages to stdout.
-   * @return 1 if the user is authenticated, 0 otherwise.
+   * @return ID of the user if authenticated, -1 otherwise.
+   * @throws server::QueueFullError if too many passwords are already waiting to be verified, checked
+   * before the query so a flood of logins doesn't also cost a database round trip each.
    */
-  int login(const char * username, const char * password) {
-    const char* stored_password = select_password(username, 1);
-    if (stored_password == NULL) {
-      return 0;
+  net::awaitable<int> login(std::string username, std::string password, int verbose) {
+    // a full password pool would turn the login away after the query anyway
+    if (!server::get_password_pool().admit())
+      throw server::QueueFullError();
+
+    QueryResult r = co_await async_query("select_credentials", std::vector<std::string>(1, username));
+    if (!r.ok()) {
+      verbose && std::cerr << "Error executing query: " << r.error_message() << std::endl;
+      co_return -1;
+    }
+    if (r.rows() == 0) {
+      verbose && std::cout << "User with username " << username << " not found" << std::endl;
+      co_return -1;
     }
-    return BCrypt::validatePassword(password, stored_password) ? 1 : 0;
+
+    int user_id = std::atoi(std::string(r.get(0, 0)).c_str());
+    std::string stored_password(r.get(0, 1));
+    int valid = co_await server::get_password_pool().run([&password, &stored_password] {
+      return BCrypt::validatePassword(password, stored_password) ? 1 : 0;
+    });
+    co_return valid ? user_id : -1;
   }
 
   public:
@@ -175,14 +114,18 @@ class UserHandler : public RequestHandler {
     return "/api/user";
   }
 
-  http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address){
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::get, http::verb::post};
+  }
+
+  net::awaitable<http::response<http::string_body>> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) override {
     if (req.method() == http::verb::get) {
       /**
        * -------------- GET USER --------------
        */
       auto user_id_request = request::parse_from_request(req, "user_id");
       if (!user_id_request) {
-        return request::make_bad_request_response("Invalid user id parameters", req);
+        co_return request::make_bad_request_response("Invalid user id parameters", req);
       }
 
       std::string user = *user_id_request;
@@ -190,20 +133,20 @@ class UserHandler : public RequestHandler {
       try {
         user_id = std::stoi(user);
       } catch (const std::invalid_argument& e) {
-        return request::make_bad_request_response("Invalid user id format", req);
+        co_return request::make_bad_request_response("Invalid user id format", req);
       } catch (const std::out_of_range& e) {
-        return request::make_bad_request_response("User id out of range", req);
+        co_return request::make_bad_request_response("User id out of range", req);
       }
 
       nlohmann::json response_json;
-      std::string username = select_username_from_id(user_id, 0);
+      std::string username = co_await select_username_from_id(user_id, 0);
       if (username.empty())
-        return request::make_bad_request_response("User not found", req);
+        co_return request::make_bad_request_response("User not found", req);
       
       response_json["message"] = "User found successfully";
       response_json["user_id"] = user_id;
       response_json["username"] = username;
-      return request::make_ok_request_response(response_json.dump(4), req);
+      co_return request::make_ok_response(response_json, req);
     } else if (req.method() == http::verb::post) {
       /**
       * -------------- LOGIN USER --------------
@@ -213,38 +156,41 @@ class UserHandler : public RequestHandler {
       try {
         json_request = nlohmann::json::parse(req.body());
       } catch (const nlohmann::json::parse_error& e) {
-        return request::make_bad_request_response("Invalid JSON request", req);
+        co_return request::make_bad_request_response("Invalid JSON request", req);
       }
 
       // validation
       if (!json_request.contains("username") || !json_request.contains("password"))
-        return request::make_bad_request_response("Invalid request: Missing required fields (username | password).", req);
+        co_return request::make_bad_request_response("Invalid request: Missing required fields (username | password).", req);
       if (!json_request["username"].is_string() || !json_request["password"].is_string())
-        return request::make_bad_request_response("Invalid request: 'username' and 'password' must be strings.", req);
+        co_return request::make_bad_request_response("Invalid request: 'username' and 'password' must be strings.", req);
 
-      std::string_view username_str = json_request["username"].get<std::string_view>();
-      std::string_view password_str = json_request["password"].get<std::string_view>();
-      const char *username = username_str.data();
-      const char *password = password_str.data();
+      std::string username = json_request["username"].get<std::string>();
+      std::string password = json_request["password"].get<std::string>();
 
-      if (!login(username, password))
-        return request::make_bad_request_response("Invalid username or password", req);
+      int user_id = -1;
+      try {
+        user_id = co_await login(username, password, 1);
+      } catch (const server::QueueFullError&) {
+        co_return request::make_service_unavailable_response("Too many login attempts, try again later", req);
+      }
+      if (user_id == -1)
+        co_return request::make_bad_request_response("Invalid username or password", req);
 
-      // get user_id, generate session_id, set session_id, set session cookie
+      // generate session_id, set session_id, set session cookie
       std::string session_id = generate_session_id(1);
-      int user_id = select_user_id(username, 1);
       int expires_at = 86400; // in seconds
 
-      if (!set_session_id(session_id, user_id, username, expires_at, ip_address, 1))
-        return request::make_bad_request_response("An unexpected error has occured.", req);
+      if (!co_await set_session_id(session_id, user_id, username, expires_at, ip_address, 1))
+        co_return request::make_bad_request_response("An unexpected error has occured.", req);
 
-      return set_session_cookie(session_id);
+      co_return set_session_cookie(session_id, req);
     } else {
-      return request::make_bad_request_response("Invalid request method", req);
+      co_return request::make_bad_request_response("Invalid request method", req);
     }
   }
 };
 
-extern "C" RequestHandler* create_user_handler() {
+extern "C" AsyncRequestHandler* create_user_async_handler() {
   return new UserHandler();
 }
\ No newline at end of file
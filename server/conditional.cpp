@@ -0,0 +1,308 @@
+#include "conditional.hpp"
+#include "parser/compiled_corpus.hpp"
+#include "request/compression.hpp"
+
+#include <atomic>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <unordered_map>
+
+namespace server {
+  std::chrono::seconds VALIDATOR_TTL(30);
+  size_t MAX_VALIDATORS = 4096;
+
+  /**
+   * Validator of the last OK response for a request target.
+   */
+  struct Validator {
+    uint64_t hash;
+    std::chrono::system_clock::time_point last_modified;
+    std::chrono::steady_clock::time_point stored_at;
+    uint64_t generation;
+  };
+
+  static std::mutex validators_mutex;
+  static std::unordered_map<std::string, Validator> validators;
+  static std::atomic<uint64_t> generation{0};
+  static std::atomic<uint64_t> not_modified_count{0};
+  static std::atomic<uint64_t> stored_count{0};
+
+  /**
+   * Format a content hash as a strong ETag.
+   * @param hash Hash of the identity body.
+   * @return Quoted ETag.
+   */
+  std::string format_etag(uint64_t hash) {
+    char etag[19];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long) hash);
+    return etag;
+  }
+
+  /**
+   * Format a time as an HTTP date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+   * @param time Time to format.
+   * @return HTTP date.
+   */
+  std::string format_http_date(std::chrono::system_clock::time_point time) {
+    std::time_t t = std::chrono::system_clock::to_time_t(time);
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char date[32];
+    strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return date;
+  }
+
+  /**
+   * Parse an HTTP date in the preferred IMF-fixdate format.
+   * @param date HTTP date to parse.
+   * @return Parsed time, nullopt if the date isn't valid.
+   */
+  std::optional<std::chrono::system_clock::time_point> parse_http_date(std::string_view date) {
+    std::string value(date);
+    struct tm tm = {};
+    const char * end = strptime(value.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (!end || *end != '\0')
+      return std::nullopt;
+    return std::chrono::system_clock::from_time_t(timegm(&tm));
+  }
+
+  /**
+   * Get the content hash out of a response's own ETag, ignoring the weak prefix and the
+   * encoding suffix. Only for reading tags the server set, a client's tag is compared whole.
+   * @param etag ETag to parse.
+   * @param hash Set to the hash in the ETag.
+   * @return 1 if the ETag holds a hash, 0 otherwise.
+   */
+  static int parse_etag(std::string_view etag, uint64_t& hash) {
+    if (etag.substr(0, 2) == "W/")
+      etag.remove_prefix(2);
+    if (etag.size() < 18 || etag.front() != '"' || etag.back() != '"')
+      return 0;
+
+    hash = 0;
+    for (size_t i = 1; i < 17; i++) {
+      char c = etag[i];
+      int digit;
+      if (c >= '0' && c <= '9')
+        digit = c - '0';
+      else if (c >= 'a' && c <= 'f')
+        digit = c - 'a' + 10;
+      else
+        return 0;
+      hash = (hash << 4) | digit;
+    }
+    // anything after the hash is the "-gzip" or "-deflate" suffix of an encoded body
+    return etag.size() == 18 || etag[17] == '-';
+  }
+
+  /**
+   * Get the ETag a body goes out with in the encoding a request negotiates, as
+   * set_content_encoding tags it.
+   * @param req Request the body is for.
+   * @param hash Hash of the identity body.
+   * @return Quoted ETag, with the "-gzip" or "-deflate" suffix if the encoding isn't identity.
+   */
+  static std::string negotiated_etag(const http::request<http::string_body>& req, uint64_t hash) {
+    auto accept_encoding = req[http::field::accept_encoding];
+    request::ContentEncoding encoding = request::negotiate_encoding(std::string_view(accept_encoding.data(), accept_encoding.size()));
+    std::string etag = format_etag(hash);
+    if (encoding != request::ENCODING_IDENTITY)
+      etag.insert(etag.size() - 1, std::string("-") + request::encoding_name(encoding));
+    return etag;
+  }
+
+  /**
+   * Check if any ETag in an If-None-Match header is a current tag. Tags are compared whole,
+   * so a client holding the gzip body doesn't get a 304 for a request that can't take gzip.
+   * @param if_none_match Value of the If-None-Match header.
+   * @param identity Tag of the identity body, which bodies too small to compress always go out as.
+   * @param encoded Tag of the body in the encoding the request negotiates.
+   * @param matched Set to the current tag that matched, or "*".
+   * @return 1 if one of the ETags matches or the header is "*", 0 otherwise.
+   */
+  static int etag_matches(std::string_view if_none_match, const std::string& identity, const std::string& encoded,
+    std::string_view& matched) {
+    while (!if_none_match.empty()) {
+      size_t comma = if_none_match.find(',');
+      std::string_view etag = if_none_match.substr(0, comma);
+      if_none_match.remove_prefix(comma == std::string_view::npos ? if_none_match.size() : comma + 1);
+
+      while (!etag.empty() && etag.front() == ' ')
+        etag.remove_prefix(1);
+      while (!etag.empty() && etag.back() == ' ')
+        etag.remove_suffix(1);
+
+      if (etag == "*") {
+        matched = etag;
+        return 1;
+      }
+      // If-None-Match uses the weak comparison
+      if (etag.substr(0, 2) == "W/")
+        etag.remove_prefix(2);
+      if (etag == identity || etag == encoded) {
+        matched = etag == identity ? identity : encoded;
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Build the 304 for a conditional GET if the client's copy matches a validator.
+   * @param req Conditional request.
+   * @param hash Hash of the current identity body.
+   * @param last_modified Time the current body first went out.
+   * @return Bodiless 304 response if the client's copy is current, nullopt otherwise.
+   */
+  static std::optional<http::response<http::string_body>> make_not_modified(const http::request<http::string_body>& req,
+    uint64_t hash, std::chrono::system_clock::time_point last_modified) {
+    auto if_none_match = req[http::field::if_none_match];
+    auto if_modified_since = req[http::field::if_modified_since];
+
+    // If-Modified-Since is ignored when If-None-Match is present
+    int not_modified;
+    std::string identity = format_etag(hash);
+    std::string encoded = negotiated_etag(req, hash);
+    std::string_view matched;
+    if (!if_none_match.empty()) {
+      not_modified = etag_matches(std::string_view(if_none_match.data(), if_none_match.size()), identity, encoded, matched);
+    } else {
+      // a date later than now is invalid and ignored, or any future date would match every body
+      auto since = parse_http_date(std::string_view(if_modified_since.data(), if_modified_since.size()));
+      not_modified = since && *since <= std::chrono::system_clock::now() &&
+        std::chrono::time_point_cast<std::chrono::seconds>(last_modified) <= *since;
+    }
+    if (!not_modified)
+      return std::nullopt;
+
+    http::response<http::string_body> res{http::status::not_modified, req.version()};
+    res.set(http::field::server, "Beast");
+    // the tag that matched names the representation the client has, which this request can be sent
+    if (!matched.empty() && matched != "*")
+      res.set(http::field::etag, std::string(matched));
+    res.set(http::field::last_modified, format_http_date(last_modified));
+    res.set(http::field::vary, "Accept-Encoding");
+    not_modified_count++;
+    return res;
+  }
+
+  /**
+   * Answer a conditional GET from the stored validator of its target, so a handler can skip
+   * building a body the client already has. The validator is keyed by target only, so this
+   * must only be called once the handler has rate limited and authorized the request. The
+   * validator is only used while it is younger than VALIDATOR_TTL and nothing was
+   * invalidated since it was stored.
+   *
+   * @param req Request to check.
+   * @return Bodiless 304 response if the client's copy is current, nullopt to build the body.
+   */
+  std::optional<http::response<http::string_body>> check_not_modified(const http::request<http::string_body>& req) {
+    if (req.method() != http::verb::get)
+      return std::nullopt;
+    if (req[http::field::if_none_match].empty() && req[http::field::if_modified_since].empty())
+      return std::nullopt;
+
+    Validator validator;
+    {
+      std::lock_guard<std::mutex> lock(validators_mutex);
+      auto it = validators.find(std::string(req.target().data(), req.target().size()));
+      if (it == validators.end())
+        return std::nullopt;
+      validator = it->second;
+    }
+    if (validator.generation != generation.load() || std::chrono::steady_clock::now() - validator.stored_at > VALIDATOR_TTL)
+      return std::nullopt;
+    return make_not_modified(req, validator.hash, validator.last_modified);
+  }
+
+  /**
+   * Answer a conditional GET from the OK response its handler just built, for when there
+   * was no current validator to answer it before the body was built.
+   *
+   * @param req Request to check.
+   * @param res OK response with the ETag and Last-Modified set by store_validator.
+   * @return Bodiless 304 response if the client's copy is current, nullopt to send the body.
+   */
+  std::optional<http::response<http::string_body>> check_not_modified(const http::request<http::string_body>& req,
+    const http::response<http::string_body>& res) {
+    if (res.result() != http::status::ok)
+      return std::nullopt;
+    if (req[http::field::if_none_match].empty() && req[http::field::if_modified_since].empty())
+      return std::nullopt;
+
+    uint64_t hash;
+    auto etag = res[http::field::etag];
+    auto last_modified_header = res[http::field::last_modified];
+    auto last_modified = parse_http_date(std::string_view(last_modified_header.data(), last_modified_header.size()));
+    if (!parse_etag(std::string_view(etag.data(), etag.size()), hash) || !last_modified)
+      return std::nullopt;
+    return make_not_modified(req, hash, *last_modified);
+  }
+
+  /**
+   * Store the validator of an OK response and set its ETag and Last-Modified headers.
+   * A handler can set the ETag itself when it already knows the hash of the body, as with
+   * cached categories, otherwise the body is hashed here. This runs before the body is
+   * compressed so every encoding of a body shares one hash.
+   *
+   * @param req Request the response is for.
+   * @param res Response to store the validator of.
+   * @param handler_generation Generation from before the handler ran, so a response built
+   * from data that was modified while the handler ran is never stored as current.
+   */
+  void store_validator(const http::request<http::string_body>& req, http::response<http::string_body>& res,
+    uint64_t handler_generation) {
+    if (res.result() != http::status::ok)
+      return;
+
+    uint64_t hash;
+    auto etag = res[http::field::etag];
+    if (!parse_etag(std::string_view(etag.data(), etag.size()), hash))
+      hash = parser::corpus_checksum(res.body().data(), res.body().size());
+
+    auto now = std::chrono::system_clock::now();
+    auto last_modified = now;
+    {
+      std::lock_guard<std::mutex> lock(validators_mutex);
+      std::string target(req.target().data(), req.target().size());
+      auto it = validators.find(target);
+      // an unchanged body keeps the time it first went out
+      if (it != validators.end() && it->second.hash == hash)
+        last_modified = it->second.last_modified;
+      if (it == validators.end() && validators.size() >= MAX_VALIDATORS)
+        validators.clear();
+      validators[target] = {hash, last_modified, std::chrono::steady_clock::now(), handler_generation};
+    }
+    stored_count++;
+
+    if (etag.empty())
+      res.set(http::field::etag, format_etag(hash));
+    res.set(http::field::last_modified, format_http_date(last_modified));
+  }
+
+  /**
+   * Get the current validator generation, which changes on every invalidation.
+   * @return Current generation.
+   */
+  uint64_t get_validator_generation() {
+    return generation.load();
+  }
+
+  /**
+   * Invalidate every stored validator, so the next request for each target runs its
+   * handler. Call this after anything a cacheable endpoint returns is modified.
+   */
+  void invalidate_validators() {
+    generation++;
+  }
+
+  /**
+   * Get the conditional request counters.
+   * @return Snapshot of the counters.
+   */
+  ValidatorStats get_validator_stats() {
+    std::lock_guard<std::mutex> lock(validators_mutex);
+    return {validators.size(), generation.load(), not_modified_count.load(), stored_count.load()};
+  }
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef CONDITIONAL_HPP
+#define CONDITIONAL_HPP
+
+#include <boost/beast/http.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace http = boost::beast::http;
+
+namespace server {
+  struct ValidatorStats {
+    size_t entries;
+    uint64_t generation;
+    uint64_t not_modified;
+    uint64_t stored;
+  };
+
+  // how long a stored validator can answer conditional requests without the body being built
+  extern std::chrono::seconds VALIDATOR_TTL;
+  extern size_t MAX_VALIDATORS;
+
+  std::string format_etag(uint64_t hash);
+  std::string format_http_date(std::chrono::system_clock::time_point time);
+  std::optional<std::chrono::system_clock::time_point> parse_http_date(std::string_view date);
+
+  std::optional<http::response<http::string_body>> check_not_modified(const http::request<http::string_body>& req);
+  std::optional<http::response<http::string_body>> check_not_modified(const http::request<http::string_body>& req,
+    const http::response<http::string_body>& res);
+  void store_validator(const http::request<http::string_body>& req, http::response<http::string_body>& res,
+    uint64_t handler_generation);
+  uint64_t get_validator_generation();
+  void invalidate_validators();
+  ValidatorStats get_validator_stats();
+}
+
+#endif
\ No newline at end of file
@@ -1,17 +1,77 @@
 #include "server.hpp"
 #include "request/postgres.hpp"
+#include "request/request.hpp"
+#include "request/middleware.hpp"
+#include "parser/corpus.hpp"
+#include "parser/tokenizer.hpp"
+
+#include <boost/asio/signal_set.hpp>
+
+/**
+ * Get a thread count from the config.
+ * @param value Configured thread count, falling back to the number of cores when unset or 0.
+ * @return Number of threads to use.
+ */
+static unsigned int get_thread_count(const char * value) {
+  int threads = std::atoi(value);
+  if (threads > 0)
+    return threads;
+  return std::max(1u, std::thread::hardware_concurrency());
+}
 
 int main() {
   try {
     auto const address = net::ip::make_address("0.0.0.0");
     unsigned short port = 8080;
+    unsigned int threads = get_thread_count(TRIVIA_SERVER_THREADS);
+    unsigned int worker_threads = get_thread_count(TRIVIA_WORKER_THREADS);
+    unsigned int parser_threads = get_thread_count(TRIVIA_PARSER_THREADS);
+    int worker_queue_size = std::atoi(TRIVIA_WORKER_QUEUE_SIZE);
+    if (worker_queue_size <= 0)
+      worker_queue_size = 1024;
+    // bcrypt is CPU bound, so by default it gets half the cores and the rest stay free for other requests
+    int password_threads = std::atoi(TRIVIA_PASSWORD_THREADS);
+    if (password_threads <= 0)
+      password_threads = std::max(1u, std::thread::hardware_concurrency() / 2);
+    int password_queue_size = std::atoi(TRIVIA_PASSWORD_QUEUE_SIZE);
+    if (password_queue_size <= 0)
+      password_queue_size = 64;
 
-    net::io_context ioc{1};
+    net::io_context ioc{static_cast<int>(threads)};
     auto listener = std::make_shared<server::Listener>(ioc, tcp::endpoint{address, port});
-    
-    postgres::init_connection();
-    std::cout << "Server started on " << address << ":" << port << std::endl;
+
+    if (!parser::select_tokenizer(TRIVIA_TOKENIZER))
+      std::cerr << "Tokenizer " << TRIVIA_TOKENIZER << " isn't available, using " << parser::tokenizer_isa() << std::endl;
+    parser::init_corpus("../questions/", "questions.bin", parser_threads, 1);
+    postgres::init_connection(postgres::MIN_POOL_SIZE, postgres::MAX_POOL_SIZE);
+    postgres::init_async_connection(ioc, postgres::ASYNC_POOL_SIZE);
+    request::init_session_writer(request::SESSION_WRITE_INTERVAL, request::MAX_SESSION_WRITE_BATCH);
+    request::init_permissions(1);
+    middleware::init_rate_limiter(middleware::MAX_RATE_LIMIT_ENTRIES, middleware::RATE_LIMIT_SHARDS);
+    request::init_session_cache(request::MAX_CACHE_SIZE, request::INVALID_SESSION_CACHE_SIZE, request::SESSION_CACHE_SHARDS);
+    server::init_worker_pool(worker_threads, worker_queue_size);
+    server::init_password_pool(password_threads, password_queue_size);
+    server::init_router(".");
+    std::cout << "Server started on " << address << ":" << port << " with " << threads << " threads" << std::endl;
+
+    // stop on SIGINT/SIGTERM rather than being killed, so queued session writes are flushed
+    net::signal_set signals(ioc, SIGINT, SIGTERM);
+    signals.async_wait([&ioc](const boost::system::error_code&, int) { ioc.stop(); });
+
+    // the main thread runs the event loop alongside the workers
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned int i = 0; i < threads - 1; i++) {
+      workers.emplace_back([&ioc] { ioc.run(); });
+    }
     ioc.run();
+
+    for (auto& worker : workers) {
+      worker.join();
+    }
+    server::stop_worker_pools();
+    request::stop_session_writer();
+    std::cout << "Server stopped" << std::endl;
   } catch (const std::exception& e) {
     std::cerr << "Error: " << e.what() << std::endl;
   }
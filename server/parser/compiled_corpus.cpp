@@ -0,0 +1,318 @@
+#include "compiled_corpus.hpp"
+
+#include <bit>
+#include <cstdio>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace parser {
+  /**
+   * Checksum a block of bytes, reading four independent 64 bit lanes so it runs at
+   * memory speed rather than costing as much as the parse it replaces.
+   *
+   * @param data Bytes to checksum.
+   * @param size Number of bytes.
+   * @return 64 bit checksum.
+   */
+  uint64_t corpus_checksum(const char * data, size_t size) {
+    const uint64_t prime = 0x9E3779B97F4A7C15ull;
+    uint64_t lanes[4] = {prime, prime ^ 1, prime ^ 2, prime ^ 3};
+
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+      for (int lane = 0; lane < 4; lane++) {
+        uint64_t word;
+        memcpy(&word, data + i + lane * 8, 8);
+        lanes[lane] = std::rotl(lanes[lane] ^ word, 31) * prime;
+      }
+    }
+
+    uint64_t hash = size;
+    for (int lane = 0; lane < 4; lane++) {
+      hash = (hash ^ lanes[lane]) * prime;
+    }
+    for (; i < size; i++) {
+      hash = (hash ^ (uint8_t) data[i]) * 0x100000001B3ull;
+    }
+    return hash ^ (hash >> 29);
+  }
+
+  /**
+   * Get the size and modification time of a category file.
+   * @param folder_dir Directory of the folder containing the category file.
+   * @param name Name of the category file.
+   * @param size Set to the size of the file.
+   * @param mtime_ns Set to the modification time of the file in nanoseconds.
+   * @return 1 if the file exists, 0 otherwise.
+   */
+  static int stat_category_file(const char * folder_dir, const std::string& name, uint64_t& size, int64_t& mtime_ns) {
+    struct stat st;
+    if (stat((std::string(folder_dir) + name).c_str(), &st) != 0)
+      return 0;
+    size = st.st_size;
+    mtime_ns = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return 1;
+  }
+
+  /**
+   * Round an offset up to the next 8 byte boundary.
+   * @param offset Offset to round.
+   * @return Rounded offset.
+   */
+  static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+  }
+
+  /**
+   * Parse every category file in a folder and write them out as a compiled corpus.
+   * The file is written next to the output and renamed over it, so a server starting
+   * at the same time never maps a half written corpus.
+   *
+   * @param folder_dir Directory of the folder containing the category files.
+   * @param output_path Path to write the compiled corpus to.
+   * @param threads Number of threads to parse on, 0 for one per core.
+   * @param verbose Whether to print the parse time of every file.
+   * @return 1 if the corpus was written, 0 otherwise.
+   */
+  int compile_corpus(const char * folder_dir, const char * output_path, unsigned int threads, int verbose) {
+    if constexpr (std::endian::native != std::endian::little) {
+      std::cerr << "Compiled corpora can only be written on little-endian hosts" << std::endl;
+      return 0;
+    }
+
+    std::vector<std::string> names = list_category_files(folder_dir);
+    std::vector<MappedCategory> categories = map_categories(folder_dir, names, threads, verbose);
+    auto release = [&]() {
+      for (auto& cat : categories) {
+        unmap_category(cat);
+      }
+    };
+    if (categories.size() != names.size()) {
+      std::cerr << "Failed to parse every category file in " << folder_dir << std::endl;
+      release();
+      return 0;
+    }
+
+    std::string blob;
+    std::unordered_map<std::string_view, uint32_t> interned;
+    auto intern = [&](std::string_view text) {
+      auto it = interned.find(text);
+      if (it != interned.end())
+        return it->second;
+      uint32_t offset = blob.size();
+      blob.append(text);
+      interned.emplace(text, offset);
+      return offset;
+    };
+
+    std::vector<CompiledCategory> category_table;
+    std::vector<CompiledQuestion> question_table;
+    std::vector<CompiledAnswer> answer_table;
+    category_table.reserve(categories.size());
+
+    for (size_t i = 0; i < categories.size(); i++) {
+      const MappedCategory& cat = categories[i];
+      CompiledCategory entry = {};
+      if (!stat_category_file(folder_dir, names[i], entry.source_size, entry.source_mtime_ns)) {
+        std::cerr << "Category file " << names[i] << " disappeared while compiling" << std::endl;
+        release();
+        return 0;
+      }
+      entry.name_offset = intern(cat.category);
+      entry.name_length = cat.category.size();
+      entry.first_question = question_table.size();
+      entry.question_c = cat.questions.size();
+      category_table.push_back(entry);
+
+      for (const MappedQuestion& q : cat.questions) {
+        question_table.push_back({intern(q.question), (uint32_t) q.question.size(),
+          (uint32_t) answer_table.size(), q.answers_c, q.answer_idx, 0});
+        for (uint32_t j = 0; j < q.answers_c; j++) {
+          std::string_view answer = cat.answers[q.answers_offset + j];
+          answer_table.push_back({intern(answer), (uint32_t) answer.size()});
+        }
+      }
+    }
+
+    if (blob.size() > UINT32_MAX) {
+      std::cerr << "Corpus strings don't fit in a compiled corpus" << std::endl;
+      release();
+      return 0;
+    }
+
+    CompiledHeader header = {};
+    memcpy(header.magic, COMPILED_CORPUS_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_CORPUS_VERSION;
+    header.category_c = category_table.size();
+    header.question_c = question_table.size();
+    header.answer_c = answer_table.size();
+    header.category_table = align8(sizeof(CompiledHeader));
+    header.question_table = align8(header.category_table + category_table.size() * sizeof(CompiledCategory));
+    header.answer_table = align8(header.question_table + question_table.size() * sizeof(CompiledQuestion));
+    header.string_blob = align8(header.answer_table + answer_table.size() * sizeof(CompiledAnswer));
+    header.string_blob_size = blob.size();
+    header.file_size = header.string_blob + blob.size();
+
+    std::string out(header.file_size, '\0');
+    memcpy(out.data() + header.category_table, category_table.data(), category_table.size() * sizeof(CompiledCategory));
+    memcpy(out.data() + header.question_table, question_table.data(), question_table.size() * sizeof(CompiledQuestion));
+    memcpy(out.data() + header.answer_table, answer_table.data(), answer_table.size() * sizeof(CompiledAnswer));
+    memcpy(out.data() + header.string_blob, blob.data(), blob.size());
+    header.checksum = corpus_checksum(out.data() + sizeof(CompiledHeader), out.size() - sizeof(CompiledHeader));
+    memcpy(out.data(), &header, sizeof(CompiledHeader));
+
+    release();
+
+    std::string tmp_path = std::string(output_path) + ".tmp";
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(out.data(), out.size());
+    file.close();
+    if (!file || std::rename(tmp_path.c_str(), output_path) != 0) {
+      std::cerr << "Failed to write compiled corpus " << output_path << std::endl;
+      std::remove(tmp_path.c_str());
+      return 0;
+    }
+
+    std::cout << "Compiled " << header.category_c << " categories, " << header.question_c << " questions and "
+      << header.answer_c << " answers into " << output_path << " (" << header.file_size << " bytes)" << std::endl;
+    return 1;
+  }
+
+  /**
+   * Check that a table of count entries lies inside the file.
+   * @param header Header of the compiled corpus.
+   * @param offset Offset of the table.
+   * @param count Number of entries in the table.
+   * @param entry_size Size of an entry.
+   * @return 1 if the table is in bounds and aligned, 0 otherwise.
+   */
+  static int table_fits(const CompiledHeader& header, uint64_t offset, uint64_t count, size_t entry_size) {
+    return offset % 8 == 0 && offset >= sizeof(CompiledHeader) && offset <= header.file_size
+      && count <= (header.file_size - offset) / entry_size;
+  }
+
+  /**
+   * Map a compiled corpus and point the categories into it without parsing anything.
+   * The corpus is only used if it is well formed, its checksum matches and, when the
+   * folder of category files exists, it was compiled from exactly those files as they are now.
+   *
+   * @param path Path of the compiled corpus.
+   * @param folder_dir Directory of the folder containing the category files.
+   * @param corpus Corpus to fill, which keeps the mapping alive.
+   * @param verbose Whether to print why the compiled corpus wasn't used.
+   * @return 1 if the corpus was loaded, 0 if the category files need to be parsed instead.
+   */
+  int load_compiled_corpus(const char * path, const char * folder_dir, Corpus& corpus, int verbose) {
+    if constexpr (std::endian::native != std::endian::little)
+      return 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+      verbose && std::cout << "No compiled corpus at " << path << ", parsing the category files" << std::endl;
+      return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(CompiledHeader)) {
+      close(fd);
+      std::cerr << "Ignoring compiled corpus " << path << ": too small" << std::endl;
+      return 0;
+    }
+
+    size_t size = st.st_size;
+    void * mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+      std::cerr << "Failed to map compiled corpus " << path << std::endl;
+      return 0;
+    }
+    const char * data = (const char *) mapping;
+
+    auto reject = [&](const std::string& reason) {
+      std::cerr << "Ignoring compiled corpus " << path << ": " << reason << std::endl;
+      munmap(mapping, size);
+      corpus.categories.clear();
+      return 0;
+    };
+
+    CompiledHeader header;
+    memcpy(&header, data, sizeof(CompiledHeader));
+    if (memcmp(header.magic, COMPILED_CORPUS_MAGIC, sizeof(header.magic)) != 0)
+      return reject("not a compiled corpus");
+    if (header.version != COMPILED_CORPUS_VERSION)
+      return reject("version " + std::to_string(header.version) + ", expected " + std::to_string(COMPILED_CORPUS_VERSION));
+    if (header.file_size != size)
+      return reject("truncated");
+    if (!table_fits(header, header.category_table, header.category_c, sizeof(CompiledCategory))
+      || !table_fits(header, header.question_table, header.question_c, sizeof(CompiledQuestion))
+      || !table_fits(header, header.answer_table, header.answer_c, sizeof(CompiledAnswer))
+      || !table_fits(header, header.string_blob, header.string_blob_size, 1))
+      return reject("table out of bounds");
+    if (corpus_checksum(data + sizeof(CompiledHeader), size - sizeof(CompiledHeader)) != header.checksum)
+      return reject("checksum mismatch");
+
+    const CompiledCategory * category_table = (const CompiledCategory *) (data + header.category_table);
+    const CompiledQuestion * question_table = (const CompiledQuestion *) (data + header.question_table);
+    const CompiledAnswer * answer_table = (const CompiledAnswer *) (data + header.answer_table);
+    const char * blob = data + header.string_blob;
+
+    auto blob_view = [&](uint32_t offset, uint32_t length) {
+      return std::string_view(blob + offset, length);
+    };
+    auto in_blob = [&](uint32_t offset, uint32_t length) {
+      return (uint64_t) offset + length <= header.string_blob_size;
+    };
+
+    // the category files win if they changed since the corpus was compiled
+    if (std::filesystem::is_directory(folder_dir)) {
+      std::vector<std::string> names = list_category_files(folder_dir);
+      if (names.size() != header.category_c)
+        return reject("stale, the category files were added or removed");
+      for (uint32_t i = 0; i < header.category_c; i++) {
+        const CompiledCategory& entry = category_table[i];
+        uint64_t source_size;
+        int64_t source_mtime_ns;
+        if (!in_blob(entry.name_offset, entry.name_length) || blob_view(entry.name_offset, entry.name_length) != names[i])
+          return reject("stale, the category files were renamed");
+        if (!stat_category_file(folder_dir, names[i], source_size, source_mtime_ns)
+          || source_size != entry.source_size || source_mtime_ns != entry.source_mtime_ns)
+          return reject("stale, " + names[i] + " changed");
+      }
+    }
+
+    corpus.categories.resize(header.category_c);
+    for (uint32_t i = 0; i < header.category_c; i++) {
+      const CompiledCategory& entry = category_table[i];
+      MappedCategory& cat = corpus.categories[i];
+      if (!in_blob(entry.name_offset, entry.name_length)
+        || (uint64_t) entry.first_question + entry.question_c > header.question_c)
+        return reject("category out of bounds");
+
+      cat.category = blob_view(entry.name_offset, entry.name_length);
+      cat.data = nullptr;
+      cat.size = 0;
+      cat.questions.reserve(entry.question_c);
+
+      for (uint32_t j = entry.first_question; j < entry.first_question + entry.question_c; j++) {
+        const CompiledQuestion& q = question_table[j];
+        if (!in_blob(q.text_offset, q.text_length) || (uint64_t) q.first_answer + q.answer_c > header.answer_c)
+          return reject("question out of bounds");
+
+        cat.questions.push_back({blob_view(q.text_offset, q.text_length), (uint32_t) cat.answers.size(), q.answer_c, q.answer_idx});
+        for (uint32_t k = q.first_answer; k < q.first_answer + q.answer_c; k++) {
+          if (!in_blob(answer_table[k].offset, answer_table[k].length))
+            return reject("answer out of bounds");
+          cat.answers.push_back(blob_view(answer_table[k].offset, answer_table[k].length));
+        }
+      }
+    }
+
+    corpus.compiled_data = data;
+    corpus.compiled_size = size;
+    return 1;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,71 @@
+#ifndef COMPILED_CORPUS_HEADER
+#define COMPILED_CORPUS_HEADER
+
+#include <cstddef>
+#include <cstdint>
+
+#include "corpus.hpp"
+
+namespace parser {
+  /**
+   * A compiled corpus is every category file laid out so it can be mapped and used in place.
+   * All integers are little-endian, table offsets are from the start of the file and string
+   * offsets are from the start of the string blob. Tables start on 8 byte boundaries.
+   *
+   *   CompiledHeader
+   *   CompiledCategory[category_c]  sorted by name
+   *   CompiledQuestion[question_c]  each category's questions are consecutive
+   *   CompiledAnswer[answer_c]      each question's answers are consecutive
+   *   string blob                   names, questions and answers, each stored once
+   */
+  constexpr char COMPILED_CORPUS_MAGIC[8] = {'T', 'R', 'V', 'C', 'O', 'R', 'P', 'S'};
+  constexpr uint32_t COMPILED_CORPUS_VERSION = 1;
+
+  struct CompiledHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t category_c;
+    uint32_t question_c;
+    uint32_t answer_c;
+    uint64_t file_size;
+    uint64_t checksum; // of everything after the header
+    uint64_t category_table;
+    uint64_t question_table;
+    uint64_t answer_table;
+    uint64_t string_blob;
+    uint64_t string_blob_size;
+  };
+
+  struct CompiledCategory {
+    uint32_t name_offset;
+    uint32_t name_length;
+    uint32_t first_question;
+    uint32_t question_c;
+    uint64_t source_size;     // size and modification time of the category file,
+    int64_t source_mtime_ns;  // used to tell if the compiled corpus is stale
+  };
+
+  struct CompiledQuestion {
+    uint32_t text_offset;
+    uint32_t text_length;
+    uint32_t first_answer;
+    uint32_t answer_c;
+    int32_t answer_idx;
+    uint32_t reserved;
+  };
+
+  struct CompiledAnswer {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  static_assert(sizeof(CompiledHeader) == 80, "CompiledHeader layout changed");
+  static_assert(sizeof(CompiledCategory) == 32, "CompiledCategory layout changed");
+  static_assert(sizeof(CompiledQuestion) == 24, "CompiledQuestion layout changed");
+  static_assert(sizeof(CompiledAnswer) == 8, "CompiledAnswer layout changed");
+
+  uint64_t corpus_checksum(const char * data, size_t size);
+  int compile_corpus(const char * folder_dir, const char * output_path, unsigned int threads, int verbose);
+  int load_compiled_corpus(const char * path, const char * folder_dir, Corpus& corpus, int verbose);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,195 @@
+#include "corpus.hpp"
+#include "compiled_corpus.hpp"
+#include "json_writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace parser {
+  static Corpus* global_corpus = nullptr;
+
+  /**
+   * List the category files in a folder.
+   * @param folder_dir Directory of the folder containing the category files.
+   * @return Names of the category files, sorted so the order is the same on every start.
+   */
+  std::vector<std::string> list_category_files(const char * folder_dir) {
+    std::vector<std::string> names;
+    for (const auto& entry : std::filesystem::directory_iterator(folder_dir)) {
+      if (entry.is_regular_file())
+        names.push_back(entry.path().filename().string());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+  }
+
+  /**
+   * Map and parse category files in parallel.
+   * @param folder_dir Directory of the folder containing the category files.
+   * @param names Names of the category files.
+   * @param threads Number of threads to parse on, 0 for one per core.
+   * @param verbose Whether to print the parse time of every file.
+   * @return Mapped categories in the order of the names, without the files that failed to map.
+   */
+  std::vector<MappedCategory> map_categories(const char * folder_dir, const std::vector<std::string>& names,
+    unsigned int threads, int verbose) {
+    std::vector<const char *> name_ptrs;
+    name_ptrs.reserve(names.size());
+    for (const auto& name : names) {
+      name_ptrs.push_back(name.c_str());
+    }
+
+    std::vector<MappedCategory> mapped(names.size());
+    std::vector<int> ok(names.size(), 0);
+    parse_in_parallel(folder_dir, name_ptrs.data(), name_ptrs.size(), threads, [&](int i) {
+      ok[i] = map_category(folder_dir, name_ptrs[i], mapped[i]);
+    }, verbose);
+
+    std::vector<MappedCategory> categories;
+    categories.reserve(names.size());
+    for (size_t i = 0; i < names.size(); i++) {
+      if (ok[i])
+        categories.push_back(std::move(mapped[i]));
+    }
+    return categories;
+  }
+
+  /**
+   * Load the question corpus and index the categories by name. The compiled corpus is
+   * used when it exists and matches the category files, otherwise the category files are
+   * mapped and parsed in parallel. Either way the categories are in name order.
+   *
+   * @param folder_dir Directory of the folder containing the category files.
+   * @param compiled_path Path of the compiled corpus, nullptr to always parse the text.
+   * @param threads Number of threads to parse on, 0 for one per core.
+   * @param verbose Whether to print the parse time of every file.
+   */
+  void init_corpus(const char * folder_dir, const char * compiled_path, unsigned int threads, int verbose) {
+    if (global_corpus)
+      return;
+
+    auto start = std::chrono::steady_clock::now();
+    auto corpus = new Corpus();
+    const char * loaded_from = compiled_path;
+    if (!compiled_path || !load_compiled_corpus(compiled_path, folder_dir, *corpus, verbose)) {
+      corpus->categories = map_categories(folder_dir, list_category_files(folder_dir), threads, verbose);
+      loaded_from = folder_dir;
+    }
+
+    // index only once the array is complete so the pointers stay valid
+    for (const auto& cat : corpus->categories) {
+      corpus->index.emplace(cat.category, &cat);
+    }
+    corpus->responses = std::make_unique<CachedResponse[]>(corpus->categories.size());
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Loaded " << corpus->index.size() << " categories from " << loaded_from
+      << " in " << ms << " ms (tokenizer: " << tokenizer_isa() << ")" << std::endl;
+    global_corpus = corpus;
+  }
+
+  /**
+   * Get the global corpus.
+   * @return Global corpus.
+   */
+  const Corpus& get_corpus() {
+    if (!global_corpus) {
+      throw std::runtime_error("Corpus not initialized. Call init_corpus first.");
+    }
+    return *global_corpus;
+  }
+
+  /**
+   * Find a category in the corpus by name.
+   * @param category_name Name of the category to find.
+   * @return Category if found, nullptr otherwise.
+   */
+  const MappedCategory * find_category(std::string_view category_name) {
+    const Corpus& corpus = get_corpus();
+    auto it = corpus.index.find(category_name);
+    if (it == corpus.index.end())
+      return nullptr;
+    return it->second;
+  }
+
+  /**
+   * Get the cached responses of a category, writing the identity body and its hash
+   * the first time.
+   * @param cat Category in the corpus to get the responses of.
+   * @return Cached responses of the category.
+   */
+  static CachedResponse& get_cached_response(const MappedCategory& cat) {
+    const Corpus& corpus = get_corpus();
+    CachedResponse& cached = corpus.responses[&cat - corpus.categories.data()];
+    std::call_once(cached.written[request::ENCODING_IDENTITY], [&]() {
+      cached.bodies[request::ENCODING_IDENTITY] = write_category_response(cat);
+      const std::string& body = cached.bodies[request::ENCODING_IDENTITY];
+      cached.hash = corpus_checksum(body.data(), body.size());
+      cached.ready[request::ENCODING_IDENTITY].store(true, std::memory_order_release);
+    });
+    return cached;
+  }
+
+  /**
+   * Get the OK response body for a category. The corpus never changes once loaded, so each
+   * body is written once on first request, compressed bodies at the best compression level,
+   * and every later request copies the same bytes.
+   *
+   * @param cat Category in the corpus to get the response for.
+   * @param encoding Encoding the client accepts, set to identity if the body doesn't compress.
+   * @return Complete response body in the encoding.
+   */
+  const std::string& get_category_response(const MappedCategory& cat, request::ContentEncoding& encoding) {
+    CachedResponse& cached = get_cached_response(cat);
+    if (encoding == request::ENCODING_IDENTITY)
+      return cached.bodies[request::ENCODING_IDENTITY];
+
+    const std::string& body = cached.bodies[request::ENCODING_IDENTITY];
+    std::call_once(cached.written[encoding], [&]() {
+      std::string compressed;
+      if (request::compress_body(body, encoding, request::CACHED_COMPRESSION_LEVEL, compressed) && compressed.size() < body.size())
+        cached.bodies[encoding] = std::move(compressed);
+      cached.ready[encoding].store(true, std::memory_order_release);
+    });
+
+    // an empty body means compressing didn't help
+    if (cached.bodies[encoding].empty()) {
+      encoding = request::ENCODING_IDENTITY;
+      return body;
+    }
+    return cached.bodies[encoding];
+  }
+
+  /**
+   * Get the OK response body for a category only if it has already been written, so a cached
+   * body can be sent without moving to a worker thread.
+   *
+   * @param cat Category in the corpus to get the response for.
+   * @param encoding Encoding the client accepts, set to identity if the body doesn't compress.
+   * @return Complete response body in the encoding, nullptr if it hasn't been written yet.
+   */
+  const std::string * find_category_response(const MappedCategory& cat, request::ContentEncoding& encoding) {
+    const Corpus& corpus = get_corpus();
+    CachedResponse& cached = corpus.responses[&cat - corpus.categories.data()];
+    if (!cached.ready[encoding].load(std::memory_order_acquire))
+      return nullptr;
+
+    // an empty body means compressing didn't help
+    if (cached.bodies[encoding].empty()) {
+      encoding = request::ENCODING_IDENTITY;
+      return &cached.bodies[request::ENCODING_IDENTITY];
+    }
+    return &cached.bodies[encoding];
+  }
+
+  /**
+   * Get the hash of a category's identity response body, which is computed once along
+   * with the body and used as its ETag.
+   *
+   * @param cat Category in the corpus to get the hash of.
+   * @return Hash of the response body.
+   */
+  uint64_t get_category_hash(const MappedCategory& cat) {
+    return get_cached_response(cat).hash;
+  }
+}
\ No newline at end of file
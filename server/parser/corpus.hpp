@@ -0,0 +1,59 @@
+#ifndef CORPUS_HEADER
+#define CORPUS_HEADER
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "parser.hpp"
+#include "../request/compression.hpp"
+
+namespace parser {
+  /**
+   * Transparent hash so categories can be looked up by a view into the request.
+   */
+  struct CategoryNameHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view name) const {
+      return std::hash<std::string_view>{}(name);
+    }
+  };
+
+  /**
+   * Response bodies for a category, one per content encoding. Each is written the first
+   * time the category is requested in that encoding.
+   */
+  struct CachedResponse {
+    std::once_flag written[request::ENCODING_COUNT];
+    std::atomic<bool> ready[request::ENCODING_COUNT] = {}; // set once the body in the encoding is written
+    std::string bodies[request::ENCODING_COUNT];
+    uint64_t hash; // of the identity body, for its ETag
+  };
+
+  /**
+   * Every category in the questions folder, mapped and parsed once at startup and never modified.
+   */
+  struct Corpus {
+    std::vector<MappedCategory> categories;
+    std::unordered_map<std::string, const MappedCategory*, CategoryNameHash, std::equal_to<>> index;
+    std::unique_ptr<CachedResponse[]> responses; // one per category, in the same order
+    const char * compiled_data = nullptr; // mapping the categories point into when loaded from a compiled corpus
+    size_t compiled_size = 0;
+  };
+
+  std::vector<std::string> list_category_files(const char * folder_dir);
+  std::vector<MappedCategory> map_categories(const char * folder_dir, const std::vector<std::string>& names,
+    unsigned int threads, int verbose);
+  void init_corpus(const char * folder_dir, const char * compiled_path, unsigned int threads, int verbose);
+  const Corpus& get_corpus();
+  const MappedCategory * find_category(std::string_view category_name);
+  const std::string& get_category_response(const MappedCategory& cat, request::ContentEncoding& encoding);
+  const std::string * find_category_response(const MappedCategory& cat, request::ContentEncoding& encoding);
+  uint64_t get_category_hash(const MappedCategory& cat);
+}
+#endif
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "json_writer.hpp"
+#include "../request/envelope.hpp"
+
+namespace parser {
+  /**
+   * Get the length of the UTF-8 sequence starting at a byte, if it is valid.
+   * @param text Text the sequence is in.
+   * @param pos Offset of the first byte of the sequence, which must be >= 0x80.
+   * @return Length of the sequence, 0 if it isn't valid UTF-8.
+   */
+  static size_t utf8_sequence_length(std::string_view text, size_t pos) {
+    unsigned char lead = text[pos];
+    size_t length;
+    uint32_t min;
+    uint32_t code;
+    if (lead >= 0xC2 && lead <= 0xDF) {
+      length = 2; min = 0x80; code = lead & 0x1F;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+      length = 3; min = 0x800; code = lead & 0x0F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+      length = 4; min = 0x10000; code = lead & 0x07;
+    } else {
+      return 0;
+    }
+
+    if (pos + length > text.size())
+      return 0;
+    for (size_t i = 1; i < length; i++) {
+      unsigned char c = text[pos + i];
+      if ((c & 0xC0) != 0x80)
+        return 0;
+      code = (code << 6) | (c & 0x3F);
+    }
+
+    // reject overlong encodings, surrogates and anything past U+10FFFF
+    if (code < min || (code >= 0xD800 && code <= 0xDFFF) || code > 0x10FFFF)
+      return 0;
+    return length;
+  }
+
+  /**
+   * Append a string to a JSON document as a quoted, escaped JSON string. Escapes match
+   * nlohmann::json::dump, and invalid UTF-8 is replaced with U+FFFD rather than written out.
+   *
+   * @param out Document to append to.
+   * @param text String to append.
+   */
+  void append_json_string(std::string& out, std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    out.push_back('"');
+
+    size_t run = 0; // start of the bytes that can be copied as they are
+    size_t pos = 0;
+    while (pos < text.size()) {
+      unsigned char c = text[pos];
+      if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80) {
+        pos++;
+        continue;
+      }
+
+      if (c >= 0x80) {
+        size_t length = utf8_sequence_length(text, pos);
+        if (length) {
+          pos += length;
+          continue;
+        }
+      }
+
+      out.append(text.data() + run, pos - run);
+      switch (c) {
+        case '"': out.append("\\\""); break;
+        case '\\': out.append("\\\\"); break;
+        case '\b': out.append("\\b"); break;
+        case '\f': out.append("\\f"); break;
+        case '\n': out.append("\\n"); break;
+        case '\r': out.append("\\r"); break;
+        case '\t': out.append("\\t"); break;
+        default:
+          if (c >= 0x80) {
+            out.append("\\ufffd");
+          } else {
+            char escaped[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            out.append(escaped, sizeof(escaped));
+          }
+      }
+      pos++;
+      run = pos;
+    }
+
+    out.append(text.data() + run, pos - run);
+    out.push_back('"');
+  }
+
+  /**
+   * Measure a category as JSON, exact unless strings need escaping, which only makes it longer.
+   * @param cat Category to measure.
+   * @return Size of the JSON written by write_category_json.
+   */
+  size_t category_json_size(const MappedCategory& cat) {
+    if (cat.questions.empty())
+      return sizeof("{\"category\":\"\",\"questions\":null}") - 1 + cat.category.size();
+
+    // one comma between each pair of questions
+    size_t size = sizeof("{\"category\":\"\",\"questions\":[]}") - 1 + cat.category.size() + cat.questions.size() - 1;
+    for (const MappedQuestion& q : cat.questions) {
+      size += sizeof("{\"answers\":,\"correct_answer\":,\"question\":\"\"}") - 1 + q.question.size()
+        + std::to_string(q.answer_idx).size();
+      if (q.answers_c == 0) {
+        size += sizeof("null") - 1;
+        continue;
+      }
+      // brackets, and quotes and a comma per answer but the last
+      size += 2 + q.answers_c * 3 - 1;
+      for (uint32_t j = 0; j < q.answers_c; j++)
+        size += cat.answers[q.answers_offset + j].size();
+    }
+    return size;
+  }
+
+  /**
+   * Write a category as JSON, with the same layout and key order as fetch_category(cat).dump()
+   * but straight into the output rather than through a JSON object per question and answer.
+   *
+   * @param out Document to append to.
+   * @param cat Category to write.
+   */
+  void write_category_json(std::string& out, const MappedCategory& cat) {
+    out.append("{\"category\":");
+    append_json_string(out, cat.category);
+    // fetch_category leaves empty arrays as null, keep that so clients see the same output
+    if (cat.questions.empty()) {
+      out.append(",\"questions\":null}");
+      return;
+    }
+    out.append(",\"questions\":[");
+
+    for (size_t i = 0; i < cat.questions.size(); i++) {
+      const MappedQuestion& q = cat.questions[i];
+      if (i > 0)
+        out.push_back(',');
+
+      if (q.answers_c == 0) {
+        out.append("{\"answers\":null");
+      } else {
+        out.append("{\"answers\":[");
+        for (uint32_t j = 0; j < q.answers_c; j++) {
+          if (j > 0)
+            out.push_back(',');
+          append_json_string(out, cat.answers[q.answers_offset + j]);
+        }
+        out.push_back(']');
+      }
+      out.append(",\"correct_answer\":");
+      out.append(std::to_string(q.answer_idx));
+      out.append(",\"question\":");
+      append_json_string(out, q.question);
+      out.push_back('}');
+    }
+    out.append("]}");
+  }
+
+  /**
+   * Write the whole body of an OK response for a category, message and envelope.
+   * @param cat Category to write.
+   * @return Response body.
+   */
+  std::string write_category_response(const MappedCategory& cat) {
+    // escapes add at most 0.2% to a category in the corpus, the headroom keeps them from
+    // reallocating the body to twice its size
+    size_t size = category_json_size(cat);
+    std::string out;
+    out.reserve(request::OK_ENVELOPE_PREFIX.size() + size + size / 256 + request::OK_ENVELOPE_SUFFIX.size());
+    out.append(request::OK_ENVELOPE_PREFIX);
+    write_category_json(out, cat);
+    out.append(request::OK_ENVELOPE_SUFFIX);
+    return out;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,15 @@
+#ifndef JSON_WRITER_HEADER
+#define JSON_WRITER_HEADER
+
+#include <string>
+#include <string_view>
+
+#include "parser.hpp"
+
+namespace parser {
+  void append_json_string(std::string& out, std::string_view text);
+  size_t category_json_size(const MappedCategory& cat);
+  void write_category_json(std::string& out, const MappedCategory& cat);
+  std::string write_category_response(const MappedCategory& cat);
+}
+#endif
\ No newline at end of file
@@ -1,5 +1,16 @@
 #include "parser.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #define QUESTION_PREFIX "#Q"
 #define ANSWER_PREFIX "^"
 
@@ -8,7 +19,7 @@ namespace parser {
    * Fetch the category struct and return/construct a JSON object.
    * @param cat Category struct to fetch.
    */
-  nlohmann::json fetch_category(Category& cat) {
+  nlohmann::json fetch_category(const Category& cat) {
     nlohmann::json json_response;
     json_response["category"] = cat.category;
     auto& questions_array = json_response["questions"];
@@ -28,6 +39,29 @@ namespace parser {
     return json_response;
   }
 
+  /**
+   * Fetch the mapped category struct and return/construct a JSON object.
+   * @param cat Mapped category struct to fetch.
+   */
+  nlohmann::json fetch_category(const MappedCategory& cat) {
+    nlohmann::json json_response;
+    json_response["category"] = cat.category;
+    auto& questions_array = json_response["questions"];
+
+    for (const MappedQuestion& q : cat.questions) {
+      nlohmann::json question;
+      auto& answers_array = question["answers"];
+      question["question"] = q.question;
+      question["correct_answer"] = q.answer_idx;
+
+      questions_array.push_back(std::move(question));
+      for (uint32_t j = 0; j < q.answers_c; j++) {
+        answers_array.push_back(cat.answers[q.answers_offset + j]);
+      }
+    }
+    return json_response;
+  }
+
   /**
    * Free the memory allocated for the question and its answers.
    * @param q Question struct to free.
@@ -53,7 +87,7 @@ namespace parser {
   }
 
   /**
-   * Insert a question to a category, reallocating the memory for the questions.
+   * Insert a question to a category, growing the memory for the questions.
    * It does this by copying the question to a new memory location and then
    * inserting it to the questions array of the category.
    *
@@ -61,13 +95,15 @@ namespace parser {
    * @param question Question to insert to the category.
    */
   void insert_to_category(Category& cat, Question& question) {
-    cat.questions = (Question *) realloc(cat.questions, sizeof(Question) * (cat.questions_c + 1));
+    // grow to the next power of two, the count is the only record of the capacity
+    if ((cat.questions_c & (cat.questions_c - 1)) == 0)
+      cat.questions = (Question *) realloc(cat.questions, sizeof(Question) * std::max(1, cat.questions_c * 2));
     cat.questions[cat.questions_c] = question;
     cat.questions_c++;
   }
 
   /**
-   * Insert an answer to a question, reallocating the memory for the answers.
+   * Insert an answer to a question, growing the memory for the answers.
    * It does this by copying the answer to a new memory location and then
    * inserting it to the answers array of the question.
    *
@@ -76,7 +112,8 @@ namespace parser {
    */
   void insert_answer_to_question(Question& q, const char* answer) {
     size_t len = strlen(answer);
-    q.answers = (char**) realloc(q.answers, (q.answers_c + 1) * sizeof(char*));
+    if ((q.answers_c & (q.answers_c - 1)) == 0)
+      q.answers = (char**) realloc(q.answers, std::max(1, q.answers_c * 2) * sizeof(char*));
     q.answers[q.answers_c] = (char*) malloc(len + 1);
 
     memcpy(q.answers[q.answers_c], answer, len);
@@ -105,8 +142,7 @@ namespace parser {
       delete[] file_loc;
       
       // file doesn't exist, return nothing
-      Category no_category;
-      no_category.category = "NO_CATEGORY";
+      Category no_category = {"NO_CATEGORY", nullptr, 0};
       return no_category;
     }
   
@@ -180,16 +216,207 @@ namespace parser {
   }
 
   /**
-   * Parse the categories and return the category structs.
+   * Run a parse function for every category file on a pool of threads.
+   * Files are handed out largest first, so a big file never starts last and holds up
+   * the others. The parse function writes to the slot of its file, which keeps the
+   * results in the order of the names whichever thread parses them.
+   *
    * @param folder_dir Directory of the folder containing the category files.
    * @param categories Array of category names.
    * @param categories_c Number of categories.
+   * @param threads Number of threads to parse on, 0 for one per core.
+   * @param parse Function parsing the category at an index.
+   * @param verbose Whether to print the parse time of every file.
    */
-  Category * parse_categories(const char * folder_dir, const char ** categories, int categories_c) {
-    Category * parsed_categories = (Category *) malloc(sizeof(Category) * categories_c);
+  void parse_in_parallel(const char * folder_dir, const char ** categories, int categories_c,
+    unsigned int threads, const std::function<void(int)>& parse, int verbose) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<uintmax_t> sizes(categories_c, 0);
+    std::vector<int> order(categories_c);
     for (int i = 0; i < categories_c; i++) {
-      parsed_categories[i] = parse_category(folder_dir, categories[i]);
+      std::error_code ec;
+      uintmax_t size = std::filesystem::file_size(std::string(folder_dir) + categories[i], ec);
+      sizes[i] = ec ? 0 : size;
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
+
+    if (threads == 0)
+      threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned int>(threads, std::max(1, categories_c));
+
+    std::vector<double> times(categories_c, 0);
+    std::atomic<int> next{0};
+    auto work = [&]() {
+      for (int i = next++; i < categories_c; i = next++) {
+        int idx = order[i];
+        auto file_start = std::chrono::steady_clock::now();
+        parse(idx);
+        times[idx] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - file_start).count();
+      }
+    };
+
+    // the calling thread takes a share of the files too
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned int i = 0; i < threads - 1; i++) {
+      workers.emplace_back(work);
     }
+    work();
+    for (auto& worker : workers) {
+      worker.join();
+    }
+
+    double total = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    uintmax_t total_size = 0;
+    for (int i = 0; i < categories_c; i++) {
+      total_size += sizes[i];
+      verbose && std::cout << "Parsed " << categories[i] << " (" << sizes[i] << " bytes) in " << times[i] << " ms" << std::endl;
+    }
+    std::cout << "Parsed " << categories_c << " category files (" << total_size << " bytes) in "
+      << total << " ms on " << threads << " threads" << std::endl;
+  }
+
+  /**
+   * Parse the categories in parallel and return the category structs.
+   * @param folder_dir Directory of the folder containing the category files.
+   * @param categories Array of category names.
+   * @param categories_c Number of categories.
+   * @param threads Number of threads to parse on, 0 for one per core.
+   * @param verbose Whether to print the parse time of every file.
+   * @return Categories in the same order as the names.
+   */
+  Category * parse_categories(const char * folder_dir, const char ** categories, int categories_c, unsigned int threads, int verbose) {
+    Category * parsed_categories = (Category *) malloc(sizeof(Category) * categories_c);
+    parse_in_parallel(folder_dir, categories, categories_c, threads, [&](int i) {
+      parsed_categories[i] = parse_category(folder_dir, categories[i]);
+    }, verbose);
     return parsed_categories;
   }
+
+  /**
+   * Parse category text in place. This follows the same rules as parse_category, but
+   * questions and answers are views into the text rather than copies, so the text must
+   * outlive the category. Lines are found and classified by the SIMD tokenizer.
+   *
+   * @param text Contents of the category file.
+   * @param cat Mapped category to add the questions to.
+   */
+  void parse_category_text(std::string_view text, MappedCategory& cat) {
+    const size_t question_prefix_len = strlen(QUESTION_PREFIX);
+    const size_t answer_prefix_len = strlen(ANSWER_PREFIX);
+
+    std::vector<Record> records;
+    tokenize(text, records);
+
+    MappedQuestion current_question = {{}, (uint32_t) cat.answers.size(), 0, -1};
+    std::string_view current_answer;
+    int has_answer = 0;
+    int curr_answer_c = 0;
+
+    for (const Record& record : records) {
+      std::string_view line = text.substr(record.start, record.length);
+
+      if (record.type == RECORD_QUESTION) {
+        if (current_question.answers_c > 0) {
+          cat.questions.push_back(current_question);
+          current_question = {{}, (uint32_t) cat.answers.size(), 0, -1};
+        }
+        current_question.question = line.substr(std::min(line.size(), question_prefix_len + 1));
+        curr_answer_c = 0;
+        has_answer = 0;
+      } else if (record.type == RECORD_ANSWER_KEY) {
+        current_answer = line.substr(std::min(line.size(), answer_prefix_len + 1));
+        has_answer = 1;
+      } else if (record.type == RECORD_UPPER) {
+        if (has_answer) {
+          std::string_view answer = line.substr(std::min(line.size(), (size_t) 2));
+          cat.answers.push_back(answer);
+          current_question.answers_c++;
+          if (answer == current_answer) {
+            current_question.answer_idx = curr_answer_c;
+          }
+          curr_answer_c++;
+        } else {
+          std::string_view question = current_question.question;
+          int in_text = question.data() >= text.data() && question.data() < text.data() + text.size();
+          if (in_text && question.data() + question.size() + 1 == line.data()) {
+            // the continuation directly follows the question, extend the view over it
+            current_question.question = std::string_view(question.data(), line.data() + line.size() - question.data());
+          } else {
+            cat.owned_text.push_back(std::string(question) + "\n" + std::string(line));
+            current_question.question = cat.owned_text.back();
+          }
+        }
+      } else if (record.type == RECORD_BLANK && current_question.answers_c > 0) {
+        if (current_question.question.data()) {
+          cat.questions.push_back(current_question);
+          current_question = {{}, (uint32_t) cat.answers.size(), 0, -1};
+        }
+        curr_answer_c = 0;
+      }
+    }
+
+    if (current_question.question.data() && current_question.answers_c > 0) {
+      cat.questions.push_back(current_question);
+    } else {
+      cat.answers.resize(current_question.answers_offset);
+    }
+  }
+
+  /**
+   * Map a category file into memory and parse it in place.
+   * @param folder_dir Directory of the folder containing the category file.
+   * @param category Name of the category file.
+   * @param cat Mapped category to fill, which keeps the mapping alive.
+   * @return 1 if the category was mapped, 0 otherwise.
+   */
+  int map_category(const char * folder_dir, const char * category, MappedCategory& cat) {
+    std::string file_loc = std::string(folder_dir) + category;
+    int fd = open(file_loc.c_str(), O_RDONLY);
+    if (fd < 0) {
+      std::cerr << "Category file doesn't exist!" << std::endl;
+      return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return 0;
+    }
+
+    size_t size = st.st_size;
+    void * data = nullptr;
+    if (size > 0) {
+      data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        std::cerr << "Failed to map category file " << file_loc << std::endl;
+        close(fd);
+        return 0;
+      }
+      madvise(data, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    cat.category = category;
+    cat.data = (const char *) data;
+    cat.size = size;
+    parse_category_text(std::string_view(cat.data, size), cat);
+    return 1;
+  }
+
+  /**
+   * Unmap a mapped category, invalidating its questions and answers.
+   * @param cat Mapped category to unmap.
+   */
+  void unmap_category(MappedCategory& cat) {
+    if (cat.data)
+      munmap(const_cast<char *>(cat.data), cat.size);
+    cat.questions.clear();
+    cat.answers.clear();
+    cat.owned_text.clear();
+    cat.data = nullptr;
+    cat.size = 0;
+  }
 }
\ No newline at end of file
@@ -6,10 +6,17 @@
 #include <string>
 #include <cstring>
 #include <cctype>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string_view>
+#include <vector>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <nlohmann/json.hpp>
 
+#include "tokenizer.hpp"
+
 namespace beast = boost::beast;
 namespace http = beast::http;
 
@@ -27,12 +34,43 @@ namespace parser {
     int questions_c;
   };
 
-  nlohmann::json fetch_category(Category& cat);
+  /**
+   * Question parsed in place from a mapped category file. Its answers are
+   * answers_c consecutive entries of MappedCategory::answers from answers_offset.
+   */
+  struct MappedQuestion {
+    std::string_view question;
+    uint32_t answers_offset;
+    uint32_t answers_c;
+    int answer_idx;
+  };
+
+  /**
+   * Category parsed from a memory mapped file. Questions and answers are views into
+   * the mapping, except multi-line questions that aren't contiguous in the file (CRLF
+   * line endings), which are joined into owned_text.
+   */
+  struct MappedCategory {
+    std::string category;
+    std::vector<MappedQuestion> questions;
+    std::vector<std::string_view> answers;
+    std::deque<std::string> owned_text;
+    const char * data;
+    size_t size;
+  };
+
+  nlohmann::json fetch_category(const Category& cat);
+  nlohmann::json fetch_category(const MappedCategory& cat);
   void free_question(Question& q);
   void free_category(Category& cat);
   void insert_to_category(Category& cat, Question& question, int idx);
   void create_question(Question& q, const char * question, const char** answers, int answer_c, int answer_idx);
   Category parse_category(const char * folder_dir, const char * category);
-  Category * parse_categories(const char * folder_dir, const char ** category_names, int category_c);
+  void parse_in_parallel(const char * folder_dir, const char ** categories, int categories_c,
+    unsigned int threads, const std::function<void(int)>& parse, int verbose);
+  Category * parse_categories(const char * folder_dir, const char ** category_names, int category_c, unsigned int threads, int verbose);
+  void parse_category_text(std::string_view text, MappedCategory& cat);
+  int map_category(const char * folder_dir, const char * category, MappedCategory& cat);
+  void unmap_category(MappedCategory& cat);
 }
 #endif
\ No newline at end of file
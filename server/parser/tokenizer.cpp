@@ -0,0 +1,234 @@
+#include "tokenizer.hpp"
+
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TOKENIZER_X86 1
+#endif
+
+namespace parser {
+  /**
+   * Bitmasks for a 64 byte block, bit i is set if byte i matches.
+   */
+  struct BlockMasks {
+    uint64_t newline;
+    uint64_t hash;
+    uint64_t caret;
+    uint64_t upper;
+  };
+
+  typedef BlockMasks (*ScanBlock)(const char * block);
+  typedef void (*Tokenize)(std::string_view text, std::vector<Record>& records);
+
+#ifdef TOKENIZER_X86
+  /**
+   * Scan a 64 byte block 16 bytes at a time with SSE2.
+   * @param block Block to scan.
+   * @return Masks of the interesting bytes in the block.
+   */
+  static BlockMasks scan_block_sse2(const char * block) {
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i hash = _mm_set1_epi8('#');
+    const __m128i caret = _mm_set1_epi8('^');
+    const __m128i upper_low = _mm_set1_epi8('A' - 1);
+    const __m128i upper_high = _mm_set1_epi8('Z' + 1);
+
+    BlockMasks masks = {0, 0, 0, 0};
+    for (int i = 0; i < 4; i++) {
+      __m128i bytes = _mm_loadu_si128((const __m128i *) (block + i * 16));
+      // signed compares are fine, bytes >= 0x80 are negative and never upper case
+      __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(bytes, upper_low), _mm_cmplt_epi8(bytes, upper_high));
+      masks.newline |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, newline)))) << (i * 16);
+      masks.hash |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, hash)))) << (i * 16);
+      masks.caret |= uint64_t(uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, caret)))) << (i * 16);
+      masks.upper |= uint64_t(uint16_t(_mm_movemask_epi8(upper))) << (i * 16);
+    }
+    return masks;
+  }
+
+  /**
+   * Scan a 64 byte block 32 bytes at a time with AVX2.
+   * @param block Block to scan.
+   * @return Masks of the interesting bytes in the block.
+   */
+  __attribute__((target("avx2")))
+  static BlockMasks scan_block_avx2(const char * block) {
+    const __m256i newline = _mm256_set1_epi8('\n');
+    const __m256i hash = _mm256_set1_epi8('#');
+    const __m256i caret = _mm256_set1_epi8('^');
+    const __m256i upper_low = _mm256_set1_epi8('A' - 1);
+    const __m256i upper_high = _mm256_set1_epi8('Z' + 1);
+
+    BlockMasks masks = {0, 0, 0, 0};
+    for (int i = 0; i < 2; i++) {
+      __m256i bytes = _mm256_loadu_si256((const __m256i *) (block + i * 32));
+      __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(bytes, upper_low), _mm256_cmpgt_epi8(upper_high, bytes));
+      masks.newline |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, newline)))) << (i * 32);
+      masks.hash |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, hash)))) << (i * 32);
+      masks.caret |= uint64_t(uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, caret)))) << (i * 32);
+      masks.upper |= uint64_t(uint32_t(_mm256_movemask_epi8(upper))) << (i * 32);
+    }
+    return masks;
+  }
+#endif
+
+  /**
+   * Classify a line by the masks of the block it starts in.
+   * @param text Text the line is in.
+   * @param start Offset of the line in the text.
+   * @param masks Masks of the block containing start.
+   * @param bit Position of start in the block.
+   * @return Type of the record.
+   */
+  static RecordType classify(std::string_view text, size_t start, const BlockMasks& masks, int bit) {
+    uint64_t at = uint64_t(1) << bit;
+    if (masks.hash & at)
+      return start + 1 < text.size() && text[start + 1] == 'Q' ? RECORD_QUESTION : RECORD_OTHER;
+    if (masks.caret & at)
+      return RECORD_ANSWER_KEY;
+    if (masks.upper & at)
+      return RECORD_UPPER;
+    return RECORD_OTHER;
+  }
+
+  /**
+   * Emit a record for a line, dropping a trailing carriage return.
+   * @param text Text the line is in.
+   * @param start Offset of the line in the text.
+   * @param end Offset one past the end of the line.
+   * @param type Type of the line from its first byte.
+   * @param records Records to append to.
+   */
+  static void emit(std::string_view text, size_t start, size_t end, RecordType type, std::vector<Record>& records) {
+    if (end > start && text[end - 1] == '\r')
+      end--;
+    if (end == start)
+      type = RECORD_BLANK;
+    records.push_back({start, (uint32_t) (end - start), type});
+  }
+
+  /**
+   * Split category text into line records 64 bytes at a time. Newlines and the first
+   * byte of each line are found with SIMD compares, so the bytes in between are never
+   * looked at one by one.
+   *
+   * @param text Contents of the category file.
+   * @param records Records to append the lines to.
+   */
+  template <ScanBlock scan>
+  static void tokenize_blocks(std::string_view text, std::vector<Record>& records) {
+    size_t line_start = 0;
+    RecordType line_type = RECORD_OTHER;
+    uint64_t carry = 1; // the first byte starts a line
+
+    for (size_t base = 0; base < text.size(); base += 64) {
+      BlockMasks masks;
+      if (text.size() - base >= 64) {
+        masks = scan(text.data() + base);
+      } else {
+        // pad the tail with zeros, which never match
+        char tail[64] = {0};
+        memcpy(tail, text.data() + base, text.size() - base);
+        masks = scan(tail);
+      }
+
+      uint64_t starts = (masks.newline << 1) | carry;
+      carry = masks.newline >> 63;
+
+      uint64_t events = starts | masks.newline;
+      while (events) {
+        int bit = __builtin_ctzll(events);
+        uint64_t at = uint64_t(1) << bit;
+        events &= events - 1;
+
+        if (starts & at) {
+          line_start = base + bit;
+          line_type = line_start < text.size() ? classify(text, line_start, masks, bit) : RECORD_OTHER;
+        }
+        if (masks.newline & at) {
+          emit(text, line_start, base + bit, line_type, records);
+          line_start = base + bit + 1;
+        }
+      }
+    }
+
+    // the last line may not end with a newline
+    if (line_start < text.size())
+      emit(text, line_start, text.size(), line_type, records);
+  }
+
+  /**
+   * Split category text into line records with memchr.
+   * @param text Contents of the category file.
+   * @param records Records to append the lines to.
+   */
+  static void tokenize_scalar(std::string_view text, std::vector<Record>& records) {
+    size_t pos = 0;
+    while (pos < text.size()) {
+      const char * newline = (const char *) memchr(text.data() + pos, '\n', text.size() - pos);
+      size_t end = newline ? newline - text.data() : text.size();
+
+      RecordType type = RECORD_OTHER;
+      char c = text[pos];
+      if (c == '#')
+        type = pos + 1 < text.size() && text[pos + 1] == 'Q' ? RECORD_QUESTION : RECORD_OTHER;
+      else if (c == '^')
+        type = RECORD_ANSWER_KEY;
+      else if (c >= 'A' && c <= 'Z')
+        type = RECORD_UPPER;
+
+      emit(text, pos, end, type, records);
+      pos = end + 1;
+    }
+  }
+
+  static std::pair<Tokenize, const char *> tokenizer = {tokenize_scalar, "scalar"};
+
+  /**
+   * Pick the tokenizer to use. The memchr loop is the default: on the bundled corpus glibc's
+   * vectorized memchr beats both mask walks, which only pull ahead on files of very short
+   * lines (see trivia-tokenizer-bench). Call this before the corpus is loaded.
+   *
+   * @param isa "scalar", "sse2" or "avx2".
+   * @return 1 if the tokenizer was selected, 0 if it's unknown or the CPU doesn't support it.
+   */
+  int select_tokenizer(std::string_view isa) {
+    if (isa == "scalar") {
+      tokenizer = {tokenize_scalar, "scalar"};
+      return 1;
+    }
+#ifdef TOKENIZER_X86
+    __builtin_cpu_init();
+    if (isa == "avx2" && __builtin_cpu_supports("avx2")) {
+      tokenizer = {tokenize_blocks<scan_block_avx2>, "avx2"};
+      return 1;
+    }
+    if (isa == "sse2" && __builtin_cpu_supports("sse2")) {
+      tokenizer = {tokenize_blocks<scan_block_sse2>, "sse2"};
+      return 1;
+    }
+#endif
+    return 0;
+  }
+
+  /**
+   * Get the instruction set of the selected tokenizer.
+   * @return "avx2", "sse2" or "scalar".
+   */
+  const char * tokenizer_isa() {
+    return tokenizer.second;
+  }
+
+  /**
+   * Split category text into line records, with the type of each line taken from its
+   * first byte, with the tokenizer picked by select_tokenizer.
+   *
+   * @param text Contents of the category file.
+   * @param records Records to append the lines to.
+   */
+  void tokenize(std::string_view text, std::vector<Record>& records) {
+    tokenizer.first(text, records);
+  }
+}
\ No newline at end of file
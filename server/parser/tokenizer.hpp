@@ -0,0 +1,31 @@
+#ifndef TOKENIZER_HEADER
+#define TOKENIZER_HEADER
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace parser {
+  enum RecordType : uint8_t {
+    RECORD_OTHER,
+    RECORD_BLANK,
+    RECORD_QUESTION,   // "#Q ..."
+    RECORD_ANSWER_KEY, // "^ ..."
+    RECORD_UPPER       // "A ..." answer, or a question continuation line
+  };
+
+  /**
+   * A line of a category file, without its line ending.
+   */
+  struct Record {
+    size_t start;
+    uint32_t length;
+    RecordType type;
+  };
+
+  void tokenize(std::string_view text, std::vector<Record>& records);
+  int select_tokenizer(std::string_view isa);
+  const char * tokenizer_isa();
+}
+#endif
\ No newline at end of file
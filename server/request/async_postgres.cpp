@@ -0,0 +1,613 @@
+#include "async_postgres.hpp"
+#include "postgres.hpp"
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/error.hpp>
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace postgres {
+  size_t ASYNC_POOL_SIZE = 8;
+  size_t ASYNC_POOL_MAX_WAITERS = 1024;
+  std::chrono::milliseconds ASYNC_QUERY_TIMEOUT(5000);
+  std::chrono::milliseconds ASYNC_CONNECT_TIMEOUT(2000);
+
+  static AsyncConnectionPool* global_async_pool = nullptr;
+  static AsyncConnectionPool* global_async_replica_pool = nullptr;
+
+  QueryResult::QueryResult() : result(nullptr, PQclear) {}
+
+  /**
+   * Take ownership of a libpq result.
+   * @param result Result to own.
+   */
+  QueryResult::QueryResult(PGresult* result) : result(result, PQclear) {
+    if (!ok())
+      error = status() == PGRES_PIPELINE_ABORTED ? "Skipped after an earlier statement failed" : PQresultErrorMessage(result);
+  }
+
+  /**
+   * Create a result for a query that never got one.
+   * @param error Why the query failed.
+   */
+  QueryResult::QueryResult(std::string error) : result(nullptr, PQclear), error(std::move(error)) {}
+
+  /**
+   * Check if the query succeeded.
+   * @return 1 if the query succeeded, 0 otherwise.
+   */
+  int QueryResult::ok() const {
+    return status() == PGRES_TUPLES_OK || status() == PGRES_COMMAND_OK;
+  }
+
+  /**
+   * Get the libpq status of the result.
+   * @return Status of the result, PGRES_FATAL_ERROR if the query never got one.
+   */
+  ExecStatusType QueryResult::status() const {
+    return result ? PQresultStatus(result.get()) : PGRES_FATAL_ERROR;
+  }
+
+  const std::string& QueryResult::error_message() const {
+    return error;
+  }
+
+  int QueryResult::rows() const {
+    return result ? PQntuples(result.get()) : 0;
+  }
+
+  int QueryResult::columns() const {
+    return result ? PQnfields(result.get()) : 0;
+  }
+
+  int QueryResult::is_null(int row, int column) const {
+    return PQgetisnull(result.get(), row, column);
+  }
+
+  /**
+   * Get a value of the result as text.
+   * @param row Row of the value.
+   * @param column Column of the value.
+   * @return View into the result, valid as long as the result is.
+   */
+  std::string_view QueryResult::get(int row, int column) const {
+    return std::string_view(PQgetvalue(result.get(), row, column), PQgetlength(result.get(), row, column));
+  }
+
+  /**
+   * Register a connection's socket on the io_context.
+   * @param ioc io_context to wait for the socket on.
+   * @param conn Connection, owned from now on.
+   */
+  AsyncConnection::AsyncConnection(net::io_context& ioc, PGconn* conn) : conn(conn), socket(ioc) {
+    // a connection that failed to open has no socket yet, reconnect assigns one
+    if (PQstatus(conn) == CONNECTION_OK)
+      socket.assign(PQsocket(conn));
+  }
+
+  /**
+   * Close the connection. libpq owns the socket, so it is released from asio rather than closed twice.
+   */
+  AsyncConnection::~AsyncConnection() {
+    socket.release();
+    PQfinish(conn);
+  }
+
+  /**
+   * Caller suspended in acquire. Whichever of a released connection and the deadline takes it
+   * out of the waiters queue first resumes it, and its timer is only touched under the pool mutex.
+   */
+  struct AsyncConnectionPool::Waiter {
+    std::function<void(AsyncConnection*)> resume;
+    net::steady_timer deadline;
+
+    Waiter(net::io_context& ioc, std::function<void(AsyncConnection*)> resume) : resume(std::move(resume)), deadline(ioc) {}
+  };
+
+  /**
+   * Socket wait raced against its deadline. Both waits are started under the mutex, and
+   * whichever completes first cancels the other and resumes the caller.
+   */
+  template <typename Handler>
+  struct SocketWait {
+    Handler handler;
+    net::steady_timer timer;
+    std::mutex mutex;
+    int done;
+
+    SocketWait(Handler handler, net::io_context& ioc) : handler(std::move(handler)), timer(ioc), done(0) {}
+
+    /**
+     * Resume the caller on its own executor. The mutex must be held.
+     * @param ec Outcome of the wait.
+     */
+    void complete(boost::system::error_code ec) {
+      done = 1;
+      auto executor = net::get_associated_executor(handler);
+      net::post(executor, [handler = std::move(handler), ec]() mutable { handler(ec); });
+    }
+  };
+
+  /**
+   * Create the pool, connecting and preparing every statement up front.
+   * @param ioc io_context the connections' sockets are waited on.
+   * @param conninfo libpq connection string of the database.
+   * @param size Number of connections.
+   * @param required Whether failing to connect is an error. Otherwise connections that couldn't
+   * be opened are kept closed and reopened by the first query that gets them.
+   * @param max_waiters Most callers to suspend while every connection is taken, later ones are turned away.
+   * @param acquire_timeout How long acquire waits for a connection before giving up.
+   */
+  AsyncConnectionPool::AsyncConnectionPool(net::io_context& ioc, std::string conninfo, size_t size, int required,
+    size_t max_waiters, std::chrono::milliseconds acquire_timeout)
+    : ioc(ioc), conninfo(std::move(conninfo)), max_waiters(max_waiters), acquire_timeout(acquire_timeout), queries(0),
+      failed(0), reconnects(0), pipelines(0), round_trips(0), acquire_timeouts(0), query_timeouts(0) {
+    for (size_t i = 0; i < size; i++) {
+      connections.emplace_back(create_new_connection(required));
+      idle.push_back(connections.back().get());
+    }
+  }
+
+  /**
+   * Open a connection and prepare the statements on it. This blocks, so it only runs at startup.
+   * @param required Whether to throw if the connection can't be opened.
+   * @return New connection, in non-blocking mode.
+   */
+  AsyncConnection* AsyncConnectionPool::create_new_connection(int required) {
+    PGconn* conn = PQconnectdb(conninfo.c_str());
+    if (PQstatus(conn) != CONNECTION_OK) {
+      std::string error = PQerrorMessage(conn);
+      if (!required) {
+        std::cerr << "Failed to open PostgreSQL connection, retrying on first use: " << error << std::endl;
+        return new AsyncConnection(ioc, conn);
+      }
+      PQfinish(conn);
+      throw std::runtime_error("Failed to open PostgreSQL connection: " + error);
+    }
+
+    for (size_t i = 0; i < PREPARED_STATEMENT_COUNT; i++) {
+      QueryResult result(PQprepare(conn, PREPARED_STATEMENTS[i].name, PREPARED_STATEMENTS[i].sql, 0, nullptr));
+      if (!result.ok()) {
+        PQfinish(conn);
+        throw std::runtime_error("Failed to prepare " + std::string(PREPARED_STATEMENTS[i].name) + ": " + result.error_message());
+      }
+    }
+
+    PQsetnonblocking(conn, 1);
+    return new AsyncConnection(ioc, conn);
+  }
+
+  /**
+   * Wait for a connection's socket to be ready, giving up at a deadline. A server that stops
+   * answering would otherwise hold the caller and its connection until the kernel drops the
+   * TCP connection, which takes minutes.
+   *
+   * @param c Connection to wait on, its socket must be assigned.
+   * @param type Whether to wait for the socket to be readable or writable.
+   * @param deadline When to stop waiting.
+   * @return Error of the wait, net::error::timed_out if the deadline passed first.
+   */
+  net::awaitable<boost::system::error_code> AsyncConnectionPool::wait_socket(AsyncConnection& c,
+    net::posix::stream_descriptor::wait_type type, std::chrono::steady_clock::time_point deadline) {
+    boost::system::error_code ec;
+    auto token = net::redirect_error(net::use_awaitable, ec);
+    co_await net::async_initiate<decltype(token), void(boost::system::error_code)>(
+      [this, &c, type, deadline](auto handler) {
+        auto wait = std::make_shared<SocketWait<decltype(handler)>>(std::move(handler), ioc);
+        std::lock_guard<std::mutex> lock(wait->mutex);
+        wait->timer.expires_at(deadline);
+        wait->timer.async_wait([wait, &c](boost::system::error_code ec) {
+          std::lock_guard<std::mutex> lock(wait->mutex);
+          if (ec || wait->done)
+            return;
+          c.socket.cancel();
+          wait->complete(net::error::timed_out);
+        });
+        c.socket.async_wait(type, [wait](boost::system::error_code ec) {
+          std::lock_guard<std::mutex> lock(wait->mutex);
+          if (wait->done)
+            return;
+          wait->timer.cancel();
+          wait->complete(ec);
+        });
+      }, token);
+
+    if (ec == net::error::timed_out)
+      query_timeouts++;
+    co_return ec;
+  }
+
+  /**
+   * Send everything libpq has buffered for a connection.
+   * @param c Connection to flush.
+   * @param deadline When to give up on the server reading it.
+   * @return 1 if everything was sent, 0 if the connection failed or the deadline passed.
+   */
+  net::awaitable<int> AsyncConnectionPool::flush(AsyncConnection& c, std::chrono::steady_clock::time_point deadline) {
+    int rc;
+    while ((rc = PQflush(c.conn)) == 1) {
+      if (co_await wait_socket(c, net::posix::stream_descriptor::wait_write, deadline))
+        co_return 0;
+    }
+    co_return rc == 0;
+  }
+
+  /**
+   * Wait for the results of the command sent on a connection. If the deadline passes, the
+   * command is left running and the connection has to be reopened before its next query.
+   *
+   * @param c Connection the command was sent on.
+   * @param deadline When to give up on the results.
+   * @return First result of the command, later ones are discarded.
+   */
+  net::awaitable<QueryResult> AsyncConnectionPool::read_result(AsyncConnection& c, std::chrono::steady_clock::time_point deadline) {
+    QueryResult result(std::string("No result"));
+    int have_result = 0;
+    while (true) {
+      while (PQisBusy(c.conn)) {
+        boost::system::error_code ec = co_await wait_socket(c, net::posix::stream_descriptor::wait_read, deadline);
+        if (ec == net::error::timed_out)
+          co_return QueryResult(std::string("Query timed out"));
+        if (ec)
+          co_return QueryResult(ec.message());
+        if (!PQconsumeInput(c.conn))
+          co_return QueryResult(std::string(PQerrorMessage(c.conn)));
+      }
+
+      PGresult* r = PQgetResult(c.conn);
+      if (!r)
+        break;
+      if (have_result) {
+        PQclear(r);
+      } else {
+        result = QueryResult(r);
+        have_result = 1;
+      }
+    }
+    co_return result;
+  }
+
+  /**
+   * Reopen a broken connection without blocking, then prepare the statements on it again.
+   * libpq ignores connect_timeout while polling, so the whole reconnect has its own deadline.
+   *
+   * @param c Connection to reopen.
+   * @return 1 if the connection is usable again, 0 otherwise.
+   */
+  net::awaitable<int> AsyncConnectionPool::reconnect(AsyncConnection& c) {
+    auto deadline = std::chrono::steady_clock::now() + ASYNC_CONNECT_TIMEOUT;
+    reconnects++;
+    // libpq closes the old socket and may switch sockets while connecting, so asio only
+    // holds it while waiting on it
+    c.socket.release();
+    if (!PQresetStart(c.conn))
+      co_return 0;
+
+    PostgresPollingStatusType status = PGRES_POLLING_WRITING;
+    while (status != PGRES_POLLING_OK) {
+      if (status == PGRES_POLLING_FAILED)
+        co_return 0;
+
+      c.socket.assign(PQsocket(c.conn));
+      boost::system::error_code ec = co_await wait_socket(c, status == PGRES_POLLING_READING
+        ? net::posix::stream_descriptor::wait_read : net::posix::stream_descriptor::wait_write, deadline);
+      c.socket.release();
+      if (ec)
+        co_return 0;
+      status = PQresetPoll(c.conn);
+    }
+
+    c.socket.assign(PQsocket(c.conn));
+    PQsetnonblocking(c.conn, 1);
+    for (size_t i = 0; i < PREPARED_STATEMENT_COUNT; i++) {
+      if (!PQsendPrepare(c.conn, PREPARED_STATEMENTS[i].name, PREPARED_STATEMENTS[i].sql, 0, nullptr) || !co_await flush(c, deadline))
+        co_return 0;
+      QueryResult result = co_await read_result(c, deadline);
+      if (!result.ok())
+        co_return 0;
+    }
+    co_return 1;
+  }
+
+  /**
+   * Take a connection from the pool, waiting without blocking until one is released if all are taken.
+   * Throws PoolTimeoutError if too many callers are already waiting or none is released in time.
+   * @return Connection, which must be given back with release.
+   */
+  net::awaitable<AsyncConnection*> AsyncConnectionPool::acquire() {
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      if (!idle.empty()) {
+        AsyncConnection* c = idle.front();
+        idle.pop_front();
+        co_return c;
+      }
+    }
+
+    AsyncConnection* c = co_await net::async_initiate<decltype(net::use_awaitable), void(AsyncConnection*)>(
+      [this](auto handler) {
+        // the handler resumes the coroutine, so it runs on the coroutine's executor rather
+        // than on whichever thread releases the connection
+        auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+        std::function<void(AsyncConnection*)> resume = [shared](AsyncConnection* c) {
+          auto executor = net::get_associated_executor(*shared);
+          net::post(executor, [shared, c]() { (*shared)(c); });
+        };
+
+        std::unique_lock<std::mutex> lock(pool_mutex);
+        if (!idle.empty()) {
+          AsyncConnection* c = idle.front();
+          idle.pop_front();
+          lock.unlock();
+          resume(c);
+          return;
+        }
+        if (waiters.size() >= max_waiters) {
+          lock.unlock();
+          resume(nullptr);
+          return;
+        }
+
+        auto waiter = std::make_shared<Waiter>(ioc, std::move(resume));
+        waiter->deadline.expires_after(acquire_timeout);
+        waiter->deadline.async_wait([this, waiter](boost::system::error_code ec) {
+          if (ec)
+            return;
+          std::unique_lock<std::mutex> lock(pool_mutex);
+          // a connection released as the deadline passed already took the waiter out
+          auto it = std::find(waiters.begin(), waiters.end(), waiter);
+          if (it == waiters.end())
+            return;
+          waiters.erase(it);
+          lock.unlock();
+          waiter->resume(nullptr);
+        });
+        waiters.push_back(std::move(waiter));
+      }, net::use_awaitable);
+
+    if (!c) {
+      acquire_timeouts++;
+      throw PoolTimeoutError();
+    }
+    co_return c;
+  }
+
+  /**
+   * Give a connection back to the pool, handing it straight to the longest waiting caller if there is one.
+   * @param c Connection to release.
+   */
+  void AsyncConnectionPool::release(AsyncConnection* c) {
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    if (waiters.empty()) {
+      idle.push_back(c);
+      return;
+    }
+    auto waiter = std::move(waiters.front());
+    waiters.pop_front();
+    waiter->deadline.cancel();
+    lock.unlock();
+    waiter->resume(c);
+  }
+
+  /**
+   * Run a prepared statement on a connection already taken from the pool.
+   * @param c Connection to run the statement on.
+   * @param statement Name of the prepared statement.
+   * @param params Parameters of the statement, as text.
+   * @return Result of the statement.
+   */
+  net::awaitable<QueryResult> AsyncConnectionPool::query(AsyncConnection& c, const char * statement,
+    const std::vector<std::string>& params) {
+    std::vector<const char *> values;
+    values.reserve(params.size());
+    for (const std::string& param : params)
+      values.push_back(param.c_str());
+
+    auto deadline = std::chrono::steady_clock::now() + ASYNC_QUERY_TIMEOUT;
+    QueryResult result;
+    if (!PQsendQueryPrepared(c.conn, statement, values.size(), values.data(), nullptr, nullptr, 0))
+      result = QueryResult(std::string(PQerrorMessage(c.conn)));
+    else if (!co_await flush(c, deadline))
+      result = QueryResult(std::string(PQerrorMessage(c.conn)));
+    else
+      result = co_await read_result(c, deadline);
+
+    queries++;
+    round_trips++;
+    if (!result.ok())
+      failed++;
+    co_return result;
+  }
+
+  /**
+   * Run several prepared statements on a connection already taken from the pool in one round
+   * trip, using libpq's pipeline mode. The statements run in order in one implicit transaction,
+   * so once one fails the rest are skipped and their results carry the error.
+   *
+   * @param c Connection to run the statements on.
+   * @param queries Statements to run.
+   * @return Result of each statement, in the order they were given.
+   */
+  net::awaitable<std::vector<QueryResult>> AsyncConnectionPool::pipeline(AsyncConnection& c,
+    const std::vector<PipelineQuery>& queries) {
+    auto deadline = std::chrono::steady_clock::now() + ASYNC_QUERY_TIMEOUT;
+    std::vector<QueryResult> results;
+    results.reserve(queries.size());
+    pipelines++;
+    round_trips++;
+    this->queries += queries.size();
+
+    int sent = PQenterPipelineMode(c.conn);
+    for (size_t i = 0; sent && i < queries.size(); i++) {
+      std::vector<const char *> values;
+      values.reserve(queries[i].params.size());
+      for (const std::string& param : queries[i].params)
+        values.push_back(param.c_str());
+      sent = PQsendQueryPrepared(c.conn, queries[i].statement, values.size(), values.data(), nullptr, nullptr, 0);
+    }
+    sent = sent && PQpipelineSync(c.conn) && co_await flush(c, deadline);
+
+    if (sent) {
+      // each statement's results end with a null result, and the sync with its own result,
+      // once the deadline passes the rest would only time out one by one
+      for (size_t i = 0; sent && i < queries.size(); i++) {
+        results.push_back(co_await read_result(c, deadline));
+        sent = std::chrono::steady_clock::now() < deadline;
+      }
+      if (sent && (co_await read_result(c, deadline)).status() != PGRES_PIPELINE_SYNC)
+        sent = 0;
+    }
+    if (!sent || !PQexitPipelineMode(c.conn)) {
+      std::string error = std::chrono::steady_clock::now() < deadline ? PQerrorMessage(c.conn) : "Query timed out";
+      while (results.size() < queries.size())
+        results.emplace_back(error);
+    }
+
+    for (const QueryResult& result : results) {
+      if (!result.ok())
+        failed++;
+    }
+    co_return results;
+  }
+
+  /**
+   * Check if a connection has to be reopened before it runs a query, because the server closed
+   * it or a query that failed or timed out left it mid-command.
+   * @param c Connection to check.
+   * @return 1 if the connection has to be reopened, 0 otherwise.
+   */
+  static int needs_reconnect(AsyncConnection& c) {
+    return PQstatus(c.conn) != CONNECTION_OK || PQpipelineStatus(c.conn) != PQ_PIPELINE_OFF ||
+      PQtransactionStatus(c.conn) != PQTRANS_IDLE;
+  }
+
+  /**
+   * Run a prepared statement on any connection of the pool. A connection the statement leaves
+   * broken is reopened by the next caller that takes it, so a failed or timed out statement
+   * returns without also waiting for the reconnect.
+   *
+   * @param statement Name of the prepared statement.
+   * @param params Parameters of the statement, as text.
+   * @return Result of the statement.
+   */
+  net::awaitable<QueryResult> AsyncConnectionPool::query(const char * statement, std::vector<std::string> params) {
+    AsyncConnection* c = co_await acquire();
+    if (needs_reconnect(*c))
+      co_await reconnect(*c);
+    QueryResult result = co_await query(*c, statement, params);
+    release(c);
+    co_return result;
+  }
+
+  /**
+   * Run several prepared statements on any connection of the pool in one round trip.
+   * @param queries Statements to run.
+   * @return Result of each statement, in the order they were given.
+   */
+  net::awaitable<std::vector<QueryResult>> AsyncConnectionPool::pipeline(std::vector<PipelineQuery> queries) {
+    AsyncConnection* c = co_await acquire();
+    if (needs_reconnect(*c))
+      co_await reconnect(*c);
+    std::vector<QueryResult> results = co_await pipeline(*c, queries);
+    release(c);
+    co_return results;
+  }
+
+  /**
+   * Get the pool counters.
+   * @return Snapshot of the counters.
+   */
+  AsyncPoolStats AsyncConnectionPool::get_stats() {
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    return {connections.size(), idle.size(), waiters.size(), queries.load(), failed.load(), reconnects.load(),
+      pipelines.load(), round_trips.load(), acquire_timeouts.load(), query_timeouts.load()};
+  }
+
+  /**
+   * Initialize the global asynchronous connection pool, and the replica pool if replicas are
+   * configured. Replicas that are down at startup are connected to once reads reach them.
+   *
+   * @param ioc io_context the connections' sockets are waited on.
+   * @param size Number of connections in each pool.
+   */
+  void init_async_connection(net::io_context& ioc, size_t size) {
+    if (!global_async_pool) {
+      global_async_pool = new AsyncConnectionPool(ioc, connection_string(), size, 1, ASYNC_POOL_MAX_WAITERS, POOL_ACQUIRE_TIMEOUT);
+    }
+    if (!global_async_replica_pool && has_replicas()) {
+      global_async_replica_pool = new AsyncConnectionPool(ioc, replica_connection_string(), size, 0, ASYNC_POOL_MAX_WAITERS,
+        POOL_ACQUIRE_TIMEOUT);
+    }
+  }
+
+  /**
+   * Get the global asynchronous connection pool.
+   * @return Global asynchronous connection pool.
+   */
+  AsyncConnectionPool& get_async_connection_pool() {
+    if (!global_async_pool) {
+      throw std::runtime_error("Async connection pool not initialized. Call init_async_connection first.");
+    }
+    return *global_async_pool;
+  }
+
+  /**
+   * Get the global asynchronous replica pool.
+   * @return Replica pool, nullptr if no replicas are configured.
+   */
+  AsyncConnectionPool* get_async_replica_pool() {
+    return global_async_replica_pool;
+  }
+
+  /**
+   * Run a prepared statement on the pool it belongs to. Reads go to the replicas while they
+   * are reachable and are run again on the primary if a replica fails them, everything else
+   * goes to the primary.
+   *
+   * @param statement Name of the prepared statement.
+   * @param params Parameters of the statement, as text.
+   * @return Result of the statement.
+   */
+  net::awaitable<QueryResult> async_query(const char * statement, std::vector<std::string> params) {
+    if (global_async_replica_pool && statement_target(statement) == STATEMENT_READ && replicas_available()) {
+      QueryResult result = co_await global_async_replica_pool->query(statement, params);
+      if (result.ok())
+        co_return result;
+      std::cerr << "Read replica failed " << statement << ", reading from the primary: " << result.error_message() << std::endl;
+      mark_replicas_down();
+      record_replica_fallback();
+    }
+    co_return co_await get_async_connection_pool().query(statement, std::move(params));
+  }
+
+  /**
+   * Run several prepared statements in one round trip on the pool they belong to. The pipeline
+   * goes to the replicas only if every statement in it is a read.
+   *
+   * @param queries Statements to run.
+   * @return Result of each statement, in the order they were given.
+   */
+  net::awaitable<std::vector<QueryResult>> async_pipeline(std::vector<PipelineQuery> queries) {
+    int reads = global_async_replica_pool && replicas_available();
+    for (size_t i = 0; reads && i < queries.size(); i++)
+      reads = statement_target(queries[i].statement) == STATEMENT_READ;
+
+    if (reads) {
+      std::vector<QueryResult> results = co_await global_async_replica_pool->pipeline(queries);
+      int ok = 1;
+      for (size_t i = 0; ok && i < results.size(); i++)
+        ok = results[i].ok();
+      if (ok)
+        co_return results;
+      std::cerr << "Read replica failed a pipeline, reading from the primary" << std::endl;
+      mark_replicas_down();
+      record_replica_fallback();
+    }
+    co_return co_await get_async_connection_pool().pipeline(std::move(queries));
+  }
+}
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef ASYNC_POSTGRES_HPP
+#define ASYNC_POSTGRES_HPP
+
+#include <utility>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <libpq-fe.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace net = boost::asio;
+
+namespace postgres {
+  /**
+   * Result of a query on the asynchronous pool, owning the libpq result.
+   */
+  class QueryResult {
+  private:
+    std::unique_ptr<PGresult, void (*)(PGresult*)> result;
+    std::string error;
+  public:
+    QueryResult();
+    explicit QueryResult(PGresult* result);
+    explicit QueryResult(std::string error);
+
+    int ok() const;
+    ExecStatusType status() const;
+    const std::string& error_message() const;
+    int rows() const;
+    int columns() const;
+    int is_null(int row, int column) const;
+    std::string_view get(int row, int column) const;
+  };
+
+  /**
+   * Prepared statement to run as part of a pipeline.
+   */
+  struct PipelineQuery {
+    const char * statement;
+    std::vector<std::string> params;
+  };
+
+  /**
+   * Non-blocking libpq connection with its socket registered on the io_context.
+   */
+  struct AsyncConnection {
+    PGconn* conn;
+    net::posix::stream_descriptor socket;
+
+    AsyncConnection(net::io_context& ioc, PGconn* conn);
+    ~AsyncConnection();
+  };
+
+  struct AsyncPoolStats {
+    size_t size;
+    size_t idle;
+    size_t waiting;
+    uint64_t queries;
+    uint64_t failed;
+    uint64_t reconnects;
+    uint64_t pipelines;
+    uint64_t round_trips;
+    uint64_t acquire_timeouts;  // callers turned away or not given a connection in time
+    uint64_t query_timeouts;    // queries and reconnects that outlived their deadline
+  };
+
+  /**
+   * Connection pool on libpq's asynchronous API. Queries are sent with PQsendQueryPrepared and
+   * the calling coroutine is suspended on the connection's socket until the result arrives, so
+   * no thread waits on the database and one I/O thread can keep every connection busy. When all
+   * connections are taken, callers are suspended in order until one is released, and every wait
+   * on the database has a deadline so a server that stops answering can't hold them forever.
+   */
+  class AsyncConnectionPool {
+  private:
+    struct Waiter;
+
+    net::io_context& ioc;
+    std::string conninfo;
+    std::vector<std::unique_ptr<AsyncConnection>> connections;
+    std::mutex pool_mutex;
+    std::deque<AsyncConnection*> idle;
+    std::deque<std::shared_ptr<Waiter>> waiters;
+    size_t max_waiters;
+    std::chrono::milliseconds acquire_timeout;
+    std::atomic<uint64_t> queries;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> reconnects;
+    std::atomic<uint64_t> pipelines;
+    std::atomic<uint64_t> round_trips;
+    std::atomic<uint64_t> acquire_timeouts;
+    std::atomic<uint64_t> query_timeouts;
+
+    AsyncConnection* create_new_connection(int required);
+    net::awaitable<boost::system::error_code> wait_socket(AsyncConnection& c, net::posix::stream_descriptor::wait_type type,
+      std::chrono::steady_clock::time_point deadline);
+    net::awaitable<int> flush(AsyncConnection& c, std::chrono::steady_clock::time_point deadline);
+    net::awaitable<QueryResult> read_result(AsyncConnection& c, std::chrono::steady_clock::time_point deadline);
+    net::awaitable<int> reconnect(AsyncConnection& c);
+  public:
+    AsyncConnectionPool(net::io_context& ioc, std::string conninfo, size_t size, int required, size_t max_waiters,
+      std::chrono::milliseconds acquire_timeout);
+
+    AsyncConnectionPool(const AsyncConnectionPool&) = delete;
+    AsyncConnectionPool& operator=(const AsyncConnectionPool&) = delete;
+
+    net::awaitable<AsyncConnection*> acquire();
+    void release(AsyncConnection* c);
+    net::awaitable<QueryResult> query(AsyncConnection& c, const char * statement, const std::vector<std::string>& params);
+    net::awaitable<QueryResult> query(const char * statement, std::vector<std::string> params);
+    net::awaitable<std::vector<QueryResult>> pipeline(AsyncConnection& c, const std::vector<PipelineQuery>& queries);
+    net::awaitable<std::vector<QueryResult>> pipeline(std::vector<PipelineQuery> queries);
+    AsyncPoolStats get_stats();
+  };
+
+  extern size_t ASYNC_POOL_SIZE;
+  extern size_t ASYNC_POOL_MAX_WAITERS;
+  extern std::chrono::milliseconds ASYNC_QUERY_TIMEOUT;
+  extern std::chrono::milliseconds ASYNC_CONNECT_TIMEOUT;
+
+  void init_async_connection(net::io_context& ioc, size_t size);
+  AsyncConnectionPool& get_async_connection_pool();
+  AsyncConnectionPool* get_async_replica_pool();
+  net::awaitable<QueryResult> async_query(const char * statement, std::vector<std::string> params);
+  net::awaitable<std::vector<QueryResult>> async_pipeline(std::vector<PipelineQuery> queries);
+}
+
+#endif
\ No newline at end of file
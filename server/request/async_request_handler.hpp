@@ -0,0 +1,28 @@
+#ifndef ASYNC_REQUEST_HANDLER_HPP
+#define ASYNC_REQUEST_HANDLER_HPP
+
+#include <utility>
+#include <string>
+#include <vector>
+#include <boost/asio/awaitable.hpp>
+#include <boost/beast/http.hpp>
+
+namespace http = boost::beast::http;
+namespace net = boost::asio;
+
+/**
+ * Coroutine based handler, loaded from a create_<name>_async_handler export.
+ * The request and IP address outlive the returned awaitable.
+ */
+class AsyncRequestHandler {
+public:
+  virtual ~AsyncRequestHandler() = default;
+  virtual std::string get_endpoint() const = 0;
+  // methods the endpoint accepts, anything else gets a 405. empty accepts every method
+  virtual std::vector<http::verb> get_methods() const { return {}; }
+  // 1 if GET responses are the same for every user, so conditional GETs can be answered with a 304
+  virtual int is_cacheable() const { return 0; }
+  virtual net::awaitable<http::response<http::string_body>> handle_request(const http::request<http::string_body>& req, const std::string& ip_address) = 0;
+};
+
+#endif
\ No newline at end of file
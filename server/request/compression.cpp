@@ -0,0 +1,218 @@
+#include "compression.hpp"
+
+#include <zlib.h>
+#include <time.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdlib>
+
+namespace request {
+  size_t COMPRESSION_MIN_SIZE = 1024;
+  int DYNAMIC_COMPRESSION_LEVEL = Z_BEST_SPEED;
+  int CACHED_COMPRESSION_LEVEL = Z_BEST_COMPRESSION;
+
+  static std::atomic<uint64_t> compressed_count{0};
+  static std::atomic<uint64_t> precompressed_count{0};
+  static std::atomic<uint64_t> skipped_count{0};
+  static std::atomic<uint64_t> bytes_in{0};
+  static std::atomic<uint64_t> bytes_out{0};
+  static std::atomic<uint64_t> cpu_ns{0};
+
+  /**
+   * Get the CPU time used by the calling thread.
+   * @return CPU time in nanoseconds.
+   */
+  static uint64_t thread_cpu_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+  }
+
+  /**
+   * Trim spaces and tabs from both ends of a header value.
+   * @param value Value to trim.
+   * @return Trimmed value.
+   */
+  static std::string_view trim(std::string_view value) {
+    while (!value.empty() && (value.front() == ' ' || value.front() == '\t'))
+      value.remove_prefix(1);
+    while (!value.empty() && (value.back() == ' ' || value.back() == '\t'))
+      value.remove_suffix(1);
+    return value;
+  }
+
+  /**
+   * Compare a content coding to a name, ignoring case.
+   * @param coding Coding from the header.
+   * @param name Lower case name to compare to.
+   * @return 1 if they match, 0 otherwise.
+   */
+  static int coding_is(std::string_view coding, std::string_view name) {
+    return coding.size() == name.size() && std::equal(coding.begin(), coding.end(), name.begin(),
+      [](char a, char b) { return std::tolower((unsigned char) a) == b; });
+  }
+
+  /**
+   * Pick the content encoding for a response from the request's Accept-Encoding header.
+   * The coding with the highest q-value wins, gzip over deflate on a tie, and a coding
+   * with q=0 is never picked.
+   *
+   * @param accept_encoding Value of the Accept-Encoding header.
+   * @return Encoding to use.
+   */
+  ContentEncoding negotiate_encoding(std::string_view accept_encoding) {
+    double q_gzip = -1, q_deflate = -1, q_any = -1;
+
+    while (!accept_encoding.empty()) {
+      size_t comma = accept_encoding.find(',');
+      std::string_view item = trim(accept_encoding.substr(0, comma));
+      accept_encoding.remove_prefix(comma == std::string_view::npos ? accept_encoding.size() : comma + 1);
+
+      size_t semicolon = item.find(';');
+      std::string_view coding = trim(item.substr(0, semicolon));
+      double q = 1;
+      if (semicolon != std::string_view::npos) {
+        std::string_view params = trim(item.substr(semicolon + 1));
+        if (params.size() > 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=')
+          q = std::strtod(std::string(params.substr(2)).c_str(), nullptr);
+      }
+
+      if (coding_is(coding, "gzip") || coding_is(coding, "x-gzip"))
+        q_gzip = q;
+      else if (coding_is(coding, "deflate"))
+        q_deflate = q;
+      else if (coding == "*")
+        q_any = q;
+    }
+
+    // codings that aren't listed take the q-value of *
+    if (q_gzip < 0)
+      q_gzip = q_any;
+    if (q_deflate < 0)
+      q_deflate = q_any;
+
+    if (q_gzip > 0 && q_gzip >= q_deflate)
+      return ENCODING_GZIP;
+    if (q_deflate > 0)
+      return ENCODING_DEFLATE;
+    return ENCODING_IDENTITY;
+  }
+
+  /**
+   * Get the Content-Encoding name of an encoding.
+   * @param encoding Encoding to name.
+   * @return Name of the encoding.
+   */
+  const char * encoding_name(ContentEncoding encoding) {
+    switch (encoding) {
+      case ENCODING_GZIP: return "gzip";
+      case ENCODING_DEFLATE: return "deflate";
+      default: return "identity";
+    }
+  }
+
+  /**
+   * Compress a body in one call with zlib. deflate is the zlib format (RFC 1950), which
+   * is what HTTP means by it, and gzip is the gzip format (RFC 1952).
+   *
+   * @param body Body to compress.
+   * @param encoding Encoding to compress with, gzip or deflate.
+   * @param level zlib compression level.
+   * @param out Set to the compressed body.
+   * @return 1 if the body was compressed, 0 otherwise.
+   */
+  int compress_body(std::string_view body, ContentEncoding encoding, int level, std::string& out) {
+    if (encoding != ENCODING_GZIP && encoding != ENCODING_DEFLATE)
+      return 0;
+
+    uint64_t start = thread_cpu_ns();
+    z_stream stream = {};
+    int window_bits = encoding == ENCODING_GZIP ? 15 + 16 : 15;
+    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+      return 0;
+
+    out.resize(deflateBound(&stream, body.size()));
+    stream.next_in = (Bytef *) body.data();
+    stream.avail_in = body.size();
+    stream.next_out = (Bytef *) out.data();
+    stream.avail_out = out.size();
+    int result = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+
+    if (result != Z_STREAM_END) {
+      out.clear();
+      return 0;
+    }
+
+    compressed_count++;
+    bytes_in += body.size();
+    bytes_out += out.size();
+    cpu_ns += thread_cpu_ns() - start;
+    return 1;
+  }
+
+  /**
+   * Mark a response as compressed and as varying by Accept-Encoding. An ETag already on
+   * the response gets the encoding appended.
+   * @param res Response to mark.
+   * @param encoding Encoding of the body.
+   */
+  void set_content_encoding(http::response<http::string_body>& res, ContentEncoding encoding) {
+    res.set(http::field::vary, "Accept-Encoding");
+    if (encoding == ENCODING_IDENTITY)
+      return;
+    res.set(http::field::content_encoding, encoding_name(encoding));
+
+    // a strong ETag names one representation, so each encoding gets its own
+    auto etag = res[http::field::etag];
+    if (etag.size() >= 2 && etag.back() == '"') {
+      std::string tagged(etag.data(), etag.size() - 1);
+      res.set(http::field::etag, tagged + "-" + encoding_name(encoding) + "\"");
+    }
+  }
+
+  /**
+   * Compress a dynamic response at a fast level, if it is big enough for that to pay off.
+   * Responses a handler already encoded, such as cached categories, are left alone.
+   *
+   * @param res Response to compress.
+   * @param encoding Encoding the client accepts.
+   */
+  void compress_response(http::response<http::string_body>& res, ContentEncoding encoding) {
+    if (res.count(http::field::content_encoding) || res.body().size() < COMPRESSION_MIN_SIZE)
+      return;
+
+    res.set(http::field::vary, "Accept-Encoding");
+    if (encoding == ENCODING_IDENTITY)
+      return;
+
+    std::string out;
+    if (!compress_body(res.body(), encoding, DYNAMIC_COMPRESSION_LEVEL, out) || out.size() >= res.body().size()) {
+      skipped_count++;
+      return;
+    }
+
+    res.body() = std::move(out);
+    set_content_encoding(res, encoding);
+    res.prepare_payload();
+  }
+
+  /**
+   * Count a response served from a body compressed ahead of time.
+   */
+  void record_precompressed() {
+    precompressed_count++;
+  }
+
+  /**
+   * Get the compression counters.
+   * @return Snapshot of the counters.
+   */
+  CompressionStats get_compression_stats() {
+    return {compressed_count.load(), precompressed_count.load(), skipped_count.load(),
+      bytes_in.load(), bytes_out.load(), cpu_ns.load() / 1000};
+  }
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef COMPRESSION_HPP
+#define COMPRESSION_HPP
+
+#include <boost/beast/http.hpp>
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace http = boost::beast::http;
+
+namespace request {
+  enum ContentEncoding {
+    ENCODING_IDENTITY,
+    ENCODING_GZIP,
+    ENCODING_DEFLATE,
+    ENCODING_COUNT
+  };
+
+  struct CompressionStats {
+    uint64_t compressed;      // bodies compressed, dynamic or cached
+    uint64_t precompressed;   // responses served from an already compressed body
+    uint64_t skipped;         // bodies left alone because compressing didn't make them smaller
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t cpu_us;
+  };
+
+  // bodies smaller than this go out as they are, the headers cost more than the saving
+  extern size_t COMPRESSION_MIN_SIZE;
+  extern int DYNAMIC_COMPRESSION_LEVEL;
+  extern int CACHED_COMPRESSION_LEVEL;
+
+  ContentEncoding negotiate_encoding(std::string_view accept_encoding);
+  const char * encoding_name(ContentEncoding encoding);
+  int compress_body(std::string_view body, ContentEncoding encoding, int level, std::string& out);
+  void set_content_encoding(http::response<http::string_body>& res, ContentEncoding encoding);
+  void compress_response(http::response<http::string_body>& res, ContentEncoding encoding);
+  void record_precompressed();
+  CompressionStats get_compression_stats();
+}
+
+#endif
\ No newline at end of file
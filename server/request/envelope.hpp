@@ -0,0 +1,15 @@
+#ifndef ENVELOPE_HPP
+#define ENVELOPE_HPP
+
+#include <string_view>
+
+namespace request {
+  /**
+   * Every OK response body is {"status":"ok","message":<message>}. The envelope is kept
+   * preformatted so the message is the only part serialized per response.
+   */
+  inline constexpr std::string_view OK_ENVELOPE_PREFIX = "{\"status\":\"ok\",\"message\":";
+  inline constexpr std::string_view OK_ENVELOPE_SUFFIX = "}";
+}
+
+#endif
\ No newline at end of file
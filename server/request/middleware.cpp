@@ -1,64 +1,263 @@
 #include "middleware.hpp"
 
+#include <algorithm>
+#include <arpa/inet.h>
+#include <stdexcept>
+
 namespace middleware {
   /* rate limiting */
   int MAX_REQUESTS_PER_SECOND = 5;
-  std::mutex rate_limit_mutex;
-  std::unordered_map<std::string, RateLimitData> rate_limit_cache;
+  size_t MAX_RATE_LIMIT_ENTRIES = 65536;
+  size_t RATE_LIMIT_SHARDS = 16;
+  std::chrono::milliseconds RATE_LIMIT_SWEEP_INTERVAL(5000);
+
+  static RateLimiter* global_rate_limiter = nullptr;
 
   /**
    * Check if a user has the required permissions.
    * This function checks if the user has one of the required permissions to access a resource.
    *
    * @param user_permissions Permissions the user has.
-   * @param required_permissions Permissions required to access the resource.
-   * @param num_permissions Number of permissions required.
+   * @param required_permissions Permissions required to access the resource, any one of them is enough.
    * @return 1 if the user has the required permissions, 0 otherwise.
    */
-  int check_permissions(request::UserPermissions permissions, std::string * required_permissions, int num_permissions) {
-    std::unordered_set<std::string> permission_set;
-    for (int i = 0; i < permissions.permission_count; i++) {
-      if (permissions.permissions[i].permission_name == "*")
-        return 1;
-      permission_set.insert(permissions.permissions[i].permission_name);
+  int check_permissions(const request::PermissionMask& user_permissions, const request::PermissionMask& required_permissions) {
+    return user_permissions.test(request::PERMISSION_ALL) || user_permissions.intersects(required_permissions);
+  }
+
+  /**
+   * Get the current time for rate limiting.
+   * @return Steady clock time in nanoseconds.
+   */
+  static int64_t rate_limit_now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  /**
+   * Create a rate limiter and start its sweeper thread.
+   * @param capacity Most clients to track, split evenly between the shards.
+   * @param shard_c Number of shards.
+   * @param sweep_interval How often clients whose bucket has refilled are dropped.
+   */
+  RateLimiter::RateLimiter(size_t capacity, size_t shard_c, std::chrono::milliseconds sweep_interval)
+    : shards(std::make_unique<Shard[]>(std::max<size_t>(1, shard_c))), shard_c(std::max<size_t>(1, shard_c)),
+      capacity(capacity), sweep_interval(sweep_interval), stopping(false) {
+    for (size_t i = 0; i < this->shard_c; i++) {
+      shards[i].capacity = std::max<size_t>(1, capacity / this->shard_c + (i < capacity % this->shard_c));
     }
-    
-    for (int i = 0; i < num_permissions; i++) {
-      if (permission_set.find(required_permissions[i]) != permission_set.end())
-        return 1;
+    sweeper = std::thread([this] { run_sweeper(); });
+  }
+
+  /**
+   * Stop the sweeper thread.
+   */
+  RateLimiter::~RateLimiter() {
+    {
+      std::lock_guard<std::mutex> lock(sweeper_mutex);
+      stopping = true;
     }
-    return 1;
+    sweeper_cv.notify_all();
+    sweeper.join();
   }
 
   /**
-   * Check if a user is being rate limited.
-   * This works by checking the number of requests made by the user in the last second.
-   * If the user has made more than MAX_REQUESTS_PER_SECOND requests, they are rate limited.
-   *
-   * @param ip_address IP address of the user to check.
-   * @return 1 if the user is rate limited, 0 otherwise.
+   * Drop the clients of a shard whose bucket has refilled. The caller must hold the shard's mutex.
+   * @param shard Shard to sweep.
+   * @param now Current time in nanoseconds.
+   * @return Number of clients dropped.
    */
-  int rate_limited(const std::string& ip_address) {
-    std::lock_guard<std::mutex> guard(rate_limit_mutex);
-    auto now = std::chrono::system_clock::now();
-    auto& data = rate_limit_cache[ip_address];
-
-    if (data.last_request.time_since_epoch().count() == 0 ||
-      std::chrono::duration_cast<std::chrono::seconds>(now - data.last_request).count() > 1) {
-      data.request_count = 1;
-      data.last_request = now;
+  size_t RateLimiter::sweep_shard(Shard& shard, int64_t now) {
+    size_t dropped = 0;
+    for (auto it = shard.buckets.begin(); it != shard.buckets.end();) {
+      if (it->second <= now) {
+        it = shard.buckets.erase(it);
+        dropped++;
+      } else {
+        ++it;
+      }
+    }
+    shard.expired += dropped;
+    return dropped;
+  }
+
+  /**
+   * Sweep every shard until the rate limiter is destroyed.
+   */
+  void RateLimiter::run_sweeper() {
+    std::unique_lock<std::mutex> lock(sweeper_mutex);
+    while (!sweeper_cv.wait_for(lock, sweep_interval, [this] { return stopping; })) {
+      lock.unlock();
+      sweep();
+      lock.lock();
+    }
+  }
+
+  /**
+   * Drop every client whose bucket has refilled.
+   */
+  void RateLimiter::sweep() {
+    for (size_t i = 0; i < shard_c; i++) {
+      int64_t now = rate_limit_now();
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      sweep_shard(shards[i], now);
+    }
+  }
+
+  /**
+   * Count a request against a client's limit.
+   * @param key Client and limit the request counts against.
+   * @param limit Rate limit of the endpoint.
+   * @return 1 if the client is over the limit, 0 if the request is allowed.
+   */
+  int RateLimiter::limited(const RateLimitKey& key, const RateLimit& limit) {
+    Shard& shard = shards[(RateLimitKeyHash{}(key) >> 32) % shard_c];
+    int64_t interval = (int64_t) (1e9 / limit.requests_per_second);
+    int64_t tolerance = (int64_t) (interval * (limit.burst - 1));
+    int64_t now = rate_limit_now();
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.buckets.find(key);
+    if (it == shard.buckets.end()) {
+      // make room for the client, the sweeper drops refilled clients so scanning for one here
+      // would only slow down a flood of new addresses
+      if (shard.buckets.size() >= shard.capacity) {
+        shard.buckets.erase(shard.buckets.begin());
+        shard.evicted++;
+      }
+      shard.buckets.emplace(key, now + interval);
+      shard.allowed++;
       return 0;
     }
 
-    if (std::chrono::duration_cast<std::chrono::seconds>(now - data.last_request).count() == 0) {
-      if (data.request_count > MAX_REQUESTS_PER_SECOND) {
-        return 1;
+    int64_t tat = std::max(it->second, now);
+    if (tat - now > tolerance) {
+      shard.limited++;
+      return 1;
+    }
+    it->second = tat + interval;
+    shard.allowed++;
+    return 0;
+  }
+
+  /**
+   * Get the rate limiter counters, summed over the shards.
+   * @return Snapshot of the counters.
+   */
+  RateLimiterStats RateLimiter::get_stats() const {
+    RateLimiterStats stats = {0, capacity, 0, 0, 0, 0};
+    for (size_t i = 0; i < shard_c; i++) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      stats.entries += shards[i].buckets.size();
+      stats.allowed += shards[i].allowed;
+      stats.limited += shards[i].limited;
+      stats.expired += shards[i].expired;
+      stats.evicted += shards[i].evicted;
+    }
+    return stats;
+  }
+
+  /**
+   * Parse a dotted quad IPv4 address in the canonical form the server formats client addresses
+   * in, without the copy to a C string inet_pton needs, since it runs on every rate limited request.
+   * @param address Address to parse.
+   * @param bytes Set to the 4 bytes of the address.
+   * @return 1 if the address was parsed, 0 otherwise.
+   */
+  static int parse_ipv4(std::string_view address, uint8_t * bytes) {
+    size_t pos = 0;
+    for (int i = 0; i < 4; i++) {
+      if (i > 0) {
+        if (pos >= address.size() || address[pos] != '.')
+          return 0;
+        pos++;
       }
-      data.request_count++;
-    } else {
-      data.request_count = 1;
-      data.last_request = now;
+
+      size_t start = pos;
+      unsigned value = 0;
+      while (pos < address.size() && pos - start < 3 && address[pos] >= '0' && address[pos] <= '9')
+        value = value * 10 + (address[pos++] - '0');
+      if (pos == start || value > 255 || (address[start] == '0' && pos - start > 1))
+        return 0;
+      bytes[i] = value;
     }
+    return pos == address.size();
+  }
+
+  /**
+   * Build the rate limiting key of a client. IPv4 addresses are mapped into IPv6 so both kinds
+   * share one key layout, and anything that isn't an address is hashed into one.
+   *
+   * @param ip_address IP address of the client.
+   * @param limit Rate limit the key counts against.
+   * @param key Set to the key of the client.
+   * @return 1 if the address was parsed, 0 if it was hashed.
+   */
+  int make_rate_limit_key(std::string_view ip_address, const RateLimit& limit, RateLimitKey& key) {
+    memset(key.address, 0, sizeof(key.address));
+    key.limit_id = limit.id;
+
+    if (parse_ipv4(ip_address, key.address + 12)) {
+      key.address[10] = 0xff;
+      key.address[11] = 0xff;
+      return 1;
+    }
+
+    // IPv6 link-local addresses come with a zone, which inet_pton doesn't accept
+    std::string_view address = ip_address.substr(0, ip_address.find('%'));
+    char text[INET6_ADDRSTRLEN];
+    if (address.size() < sizeof(text)) {
+      memcpy(text, address.data(), address.size());
+      text[address.size()] = '\0';
+      if (inet_pton(AF_INET6, text, key.address) == 1)
+        return 1;
+    }
+
+    uint64_t hash = make_rate_limit(ip_address, 0, 0).id;
+    memcpy(key.address, &hash, sizeof(hash));
     return 0;
   }
+
+  /**
+   * Initialize the global rate limiter.
+   * @param capacity Most clients to track.
+   * @param shard_c Number of shards.
+   */
+  void init_rate_limiter(size_t capacity, size_t shard_c) {
+    if (!global_rate_limiter)
+      global_rate_limiter = new RateLimiter(capacity, shard_c, RATE_LIMIT_SWEEP_INTERVAL);
+  }
+
+  /**
+   * Get the global rate limiter.
+   * @return Global rate limiter.
+   */
+  RateLimiter& get_rate_limiter() {
+    if (!global_rate_limiter) {
+      throw std::runtime_error("Rate limiter not initialized. Call init_rate_limiter first.");
+    }
+    return *global_rate_limiter;
+  }
+
+  /**
+   * Check if a user is being rate limited on an endpoint.
+   * @param ip_address IP address of the user to check.
+   * @param limit Rate limit of the endpoint.
+   * @return 1 if the user is rate limited, 0 otherwise.
+   */
+  int rate_limited(const std::string& ip_address, const RateLimit& limit) {
+    RateLimitKey key;
+    make_rate_limit_key(ip_address, limit, key);
+    return get_rate_limiter().limited(key, limit);
+  }
+
+  /**
+   * Check if a user is being rate limited, against the limit shared by endpoints without their own.
+   * Users get MAX_REQUESTS_PER_SECOND requests per second, with bursts of as many.
+   *
+   * @param ip_address IP address of the user to check.
+   * @return 1 if the user is rate limited, 0 otherwise.
+   */
+  int rate_limited(const std::string& ip_address) {
+    return rate_limited(ip_address, make_rate_limit("", MAX_REQUESTS_PER_SECOND, MAX_REQUESTS_PER_SECOND));
+  }
 }
\ No newline at end of file
@@ -3,22 +3,127 @@
 
 #include <iostream>
 #include <string>
-#include <unordered_set>
+#include <string_view>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <thread>
+#include <condition_variable>
 #include "request.hpp"
 
 namespace middleware {
-  struct RateLimitData {
-    int request_count;
-    std::chrono::system_clock::time_point window_start;
-    std::chrono::system_clock::time_point last_request;
+  /**
+   * Request rate allowed for one client on one endpoint. Clients can send burst requests at
+   * once, then requests_per_second after that.
+   */
+  struct RateLimit {
+    uint64_t id;
+    double requests_per_second;
+    double burst;
+  };
+
+  /**
+   * Build a rate limit for an endpoint. Limits with different endpoints count requests separately.
+   * @param endpoint Endpoint the limit applies to.
+   * @param requests_per_second Sustained requests allowed per second.
+   * @param burst Requests allowed at once.
+   * @return Rate limit of the endpoint.
+   */
+  constexpr RateLimit make_rate_limit(std::string_view endpoint, double requests_per_second, double burst) {
+    uint64_t id = 0xcbf29ce484222325ull;
+    for (char c : endpoint)
+      id = (id ^ (unsigned char) c) * 0x100000001b3ull;
+    return {id, requests_per_second, burst};
+  }
+
+  struct RateLimiterStats {
+    size_t entries;
+    size_t capacity;
+    uint64_t allowed;
+    uint64_t limited;
+    uint64_t expired;
+    uint64_t evicted;
+  };
+
+  /**
+   * Client address as 16 bytes, IPv4 addresses mapped into IPv6, plus the limit it is counted against.
+   */
+  struct RateLimitKey {
+    uint8_t address[16];
+    uint64_t limit_id;
+
+    bool operator==(const RateLimitKey& other) const {
+      return limit_id == other.limit_id && memcmp(address, other.address, sizeof(address)) == 0;
+    }
+  };
+
+  struct RateLimitKeyHash {
+    size_t operator()(const RateLimitKey& key) const {
+      uint64_t low, high;
+      memcpy(&low, key.address, 8);
+      memcpy(&high, key.address + 8, 8);
+      uint64_t h = (low * 0x9E3779B97F4A7C15ull) ^ high ^ key.limit_id;
+      h ^= h >> 33;
+      h *= 0xFF51AFD7ED558CCDull;
+      h ^= h >> 33;
+      return h;
+    }
+  };
+
+  /**
+   * Rate limiter using GCRA, the token bucket kept as the single time its bucket will be full
+   * again. Clients are split between shards with their own lock, and a background thread drops
+   * clients whose bucket has refilled, since they are no different from a client never seen.
+   */
+  class RateLimiter {
+  private:
+    struct Shard {
+      std::mutex mutex;
+      // theoretical arrival time of the next request, in steady clock nanoseconds
+      std::unordered_map<RateLimitKey, int64_t, RateLimitKeyHash> buckets;
+      size_t capacity;
+      uint64_t allowed = 0;
+      uint64_t limited = 0;
+      uint64_t expired = 0;
+      uint64_t evicted = 0;
+    };
+
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_c;
+    size_t capacity;
+    std::chrono::milliseconds sweep_interval;
+
+    std::mutex sweeper_mutex;
+    std::condition_variable sweeper_cv;
+    bool stopping;
+    std::thread sweeper;
+
+    size_t sweep_shard(Shard& shard, int64_t now);
+    void run_sweeper();
+  public:
+    RateLimiter(size_t capacity, size_t shard_c, std::chrono::milliseconds sweep_interval);
+    ~RateLimiter();
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    int limited(const RateLimitKey& key, const RateLimit& limit);
+    void sweep();
+    RateLimiterStats get_stats() const;
   };
 
   // rate limiting
   extern int MAX_REQUESTS_PER_SECOND;
-  extern std::mutex rate_limit_mutex;
-  extern std::unordered_map<std::string, RateLimitData> rate_limit_cache;
+  extern size_t MAX_RATE_LIMIT_ENTRIES;
+  extern size_t RATE_LIMIT_SHARDS;
+  extern std::chrono::milliseconds RATE_LIMIT_SWEEP_INTERVAL;
 
-  int check_permissions(request::UserPermissions user_permissions, std::string * required_permissions, int num_permissions);
+  int check_permissions(const request::PermissionMask& user_permissions, const request::PermissionMask& required_permissions);
+  int make_rate_limit_key(std::string_view ip_address, const RateLimit& limit, RateLimitKey& key);
+  void init_rate_limiter(size_t capacity, size_t shard_c);
+  RateLimiter& get_rate_limiter();
+  int rate_limited(const std::string& ip_address, const RateLimit& limit);
   int rate_limited(const std::string& ip_address);
 }
 
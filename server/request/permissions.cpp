@@ -0,0 +1,241 @@
+#include "permissions.hpp"
+#include "postgres.hpp"
+#include "async_postgres.hpp"
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace postgres;
+namespace request {
+  std::chrono::seconds PERMISSION_CACHE_TTL(60);
+  size_t MAX_PERMISSION_CACHE_SIZE = 4096;
+
+  static const char * BUILTIN_PERMISSIONS[BUILTIN_PERMISSION_COUNT] = {
+    "*", "superuser", "category.admin", "category.put", "category.delete", "question.put", "question.delete"
+  };
+
+  struct CachedPermissions {
+    PermissionMask mask;
+    std::chrono::steady_clock::time_point expiry;
+  };
+
+  static std::mutex names_mutex;
+  static std::unordered_map<std::string, int> permission_ids;
+
+  static std::mutex cache_mutex;
+  static std::unordered_map<int, CachedPermissions> permission_cache;
+  static std::atomic<uint64_t> hit_count{0};
+  static std::atomic<uint64_t> miss_count{0};
+
+  /**
+   * Get the ID of a permission name, giving it the next free ID if it has none yet.
+   * The caller must hold names_mutex.
+   * @param name Name of the permission.
+   * @return ID of the permission, -1 if every ID is taken.
+   */
+  static int intern_permission(const std::string& name) {
+    if (permission_ids.empty()) {
+      for (int i = 0; i < BUILTIN_PERMISSION_COUNT; i++)
+        permission_ids.emplace(BUILTIN_PERMISSIONS[i], i);
+    }
+
+    auto it = permission_ids.find(name);
+    if (it != permission_ids.end())
+      return it->second;
+    if (permission_ids.size() >= MAX_PERMISSIONS)
+      return -1;
+    int id = permission_ids.size();
+    permission_ids.emplace(name, id);
+    return id;
+  }
+
+  /**
+   * Intern every permission in the database, so permissions looked up by name at request time
+   * don't need a query. Permissions added later are interned when a user holding them is loaded.
+   * @param verbose Whether to print messages to stdout.
+   */
+  void init_permissions(int verbose) {
+    try {
+      pqxx::result r = exec_prepared("select_permissions");
+
+      std::lock_guard<std::mutex> lock(names_mutex);
+      for (size_t i = 0; i < r.size(); i++) {
+        if (intern_permission(r[i][0].c_str()) < 0)
+          verbose && std::cerr << "Too many permissions, ignoring " << r[i][0].c_str() << std::endl;
+      }
+      verbose && std::cout << "Interned " << permission_ids.size() << " permissions" << std::endl;
+    } catch (const PoolTimeoutError&) {
+      throw;
+    } catch (const std::exception &e) {
+      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
+    } catch (...) {
+      verbose && std::cerr << "Unknown error while executing query" << std::endl;
+    }
+  }
+
+  /**
+   * Get the ID of a permission by name, for permissions that aren't known at compile time.
+   * @param name Name of the permission.
+   * @return ID of the permission, -1 if no user holds a permission of that name.
+   */
+  int find_permission(std::string_view name) {
+    std::lock_guard<std::mutex> lock(names_mutex);
+    auto it = permission_ids.find(std::string(name));
+    if (it != permission_ids.end())
+      return it->second;
+    for (int i = 0; i < BUILTIN_PERMISSION_COUNT; i++) {
+      if (name == BUILTIN_PERMISSIONS[i])
+        return i;
+    }
+    return -1;
+  }
+
+  /**
+   * Get the permissions of a user if they were read recently.
+   * @param user_id ID of the user to get the permissions of.
+   * @param mask Set to the permissions of the user on a hit.
+   * @return 1 if the permissions were cached, 0 if they have to be read from the database.
+   */
+  int get_cached_user_permissions(int user_id, PermissionMask& mask) {
+    // anonymous requests have no permissions to look up
+    if (user_id < 0) {
+      mask = {};
+      return 1;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = permission_cache.find(user_id);
+    if (it != permission_cache.end() && it->second.expiry > std::chrono::steady_clock::now()) {
+      hit_count.fetch_add(1, std::memory_order_relaxed);
+      mask = it->second.mask;
+      return 1;
+    }
+    miss_count.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  /**
+   * Cache the permissions of a user read from the database.
+   * @param user_id ID of the user.
+   * @param mask Permissions of the user.
+   */
+  void cache_user_permissions(int user_id, const PermissionMask& mask) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (permission_cache.size() >= MAX_PERMISSION_CACHE_SIZE && permission_cache.find(user_id) == permission_cache.end())
+      permission_cache.clear();
+    permission_cache[user_id] = {mask, std::chrono::steady_clock::now() + PERMISSION_CACHE_TTL};
+  }
+
+  /**
+   * Build a mask from the permission names in a column of a result, interning new names.
+   * @param r Result holding the permission names.
+   * @param column Column of the names.
+   * @param verbose Whether to print messages to stdout.
+   * @return Mask of the permissions.
+   */
+  PermissionMask make_permission_mask(const postgres::QueryResult& r, int column, int verbose) {
+    PermissionMask mask;
+    std::lock_guard<std::mutex> lock(names_mutex);
+    for (int i = 0; i < r.rows(); i++) {
+      std::string name(r.get(i, column));
+      int id = intern_permission(name);
+      if (id < 0) {
+        verbose && std::cerr << "Too many permissions, ignoring " << name << std::endl;
+        continue;
+      }
+      mask.set(id);
+    }
+    return mask;
+  }
+
+  /**
+   * Get the permissions of a user, from the cache if they were read recently.
+   * @param user_id ID of the user to get the permissions of.
+   * @param verbose Whether to print messages to stdout.
+   * @return Permissions of the user, empty if the user has none or couldn't be looked up.
+   */
+  PermissionMask get_user_permissions(int user_id, int verbose) {
+    PermissionMask mask;
+    if (get_cached_user_permissions(user_id, mask))
+      return mask;
+
+    try {
+      pqxx::result r = exec_prepared("get_user_permissions", user_id);
+
+      std::lock_guard<std::mutex> lock(names_mutex);
+      for (size_t i = 0; i < r.size(); i++) {
+        int id = intern_permission(r[i][1].c_str());
+        if (id < 0) {
+          verbose && std::cerr << "Too many permissions, ignoring " << r[i][1].c_str() << std::endl;
+          continue;
+        }
+        mask.set(id);
+      }
+    } catch (const PoolTimeoutError&) {
+      throw;
+    } catch (const std::exception &e) {
+      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
+      return {};
+    } catch (...) {
+      verbose && std::cerr << "Unknown error while executing query" << std::endl;
+      return {};
+    }
+
+    cache_user_permissions(user_id, mask);
+    return mask;
+  }
+
+  /**
+   * Get the permissions of a user on the asynchronous connection pool.
+   * @param user_id ID of the user to get the permissions of.
+   * @param verbose Whether to print messages to stdout.
+   * @return Permissions of the user, empty if the user has none or couldn't be looked up.
+   */
+  net::awaitable<PermissionMask> async_get_user_permissions(int user_id, int verbose) {
+    PermissionMask mask;
+    if (get_cached_user_permissions(user_id, mask))
+      co_return mask;
+
+    postgres::QueryResult r = co_await postgres::async_query("get_user_permissions",
+      std::vector<std::string>(1, std::to_string(user_id)));
+    if (!r.ok()) {
+      verbose && std::cerr << "Error executing query: " << r.error_message() << std::endl;
+      co_return mask;
+    }
+
+    mask = make_permission_mask(r, 1, verbose);
+    cache_user_permissions(user_id, mask);
+    co_return mask;
+  }
+
+  /**
+   * Forget the cached permissions of a user, so the next check reads them from the database.
+   * @param user_id ID of the user.
+   */
+  void invalidate_user_permissions(int user_id) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    permission_cache.erase(user_id);
+  }
+
+  /**
+   * Get the permission cache counters.
+   * @return Snapshot of the counters.
+   */
+  PermissionCacheStats get_permission_cache_stats() {
+    PermissionCacheStats stats;
+    {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      stats.entries = permission_cache.size();
+    }
+    {
+      std::lock_guard<std::mutex> lock(names_mutex);
+      stats.interned = permission_ids.size();
+    }
+    stats.hits = hit_count.load(std::memory_order_relaxed);
+    stats.misses = miss_count.load(std::memory_order_relaxed);
+    return stats;
+  }
+}
\ No newline at end of file
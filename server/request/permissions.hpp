@@ -0,0 +1,91 @@
+#ifndef PERMISSIONS_HPP
+#define PERMISSIONS_HPP
+
+#include <utility>
+#include <boost/asio/awaitable.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+
+namespace postgres {
+  class QueryResult;
+}
+
+namespace net = boost::asio;
+
+namespace request {
+  /**
+   * Permissions checked by handlers. These are interned first, in this order, so handlers can
+   * build their masks at compile time. Any other permission in the database gets the next free ID.
+   */
+  enum PermissionId {
+    PERMISSION_ALL,             // "*"
+    PERMISSION_SUPERUSER,       // "superuser"
+    PERMISSION_CATEGORY_ADMIN,  // "category.admin"
+    PERMISSION_CATEGORY_PUT,    // "category.put"
+    PERMISSION_CATEGORY_DELETE, // "category.delete"
+    PERMISSION_QUESTION_PUT,    // "question.put"
+    PERMISSION_QUESTION_DELETE, // "question.delete"
+    BUILTIN_PERMISSION_COUNT
+  };
+
+  constexpr size_t MAX_PERMISSIONS = 256;
+
+  /**
+   * Set of permissions, one bit per interned permission ID.
+   */
+  struct PermissionMask {
+    uint64_t words[MAX_PERMISSIONS / 64] = {};
+
+    constexpr void set(size_t id) {
+      words[id / 64] |= uint64_t(1) << (id % 64);
+    }
+
+    constexpr int test(size_t id) const {
+      return (words[id / 64] >> (id % 64)) & 1;
+    }
+
+    constexpr int intersects(const PermissionMask& other) const {
+      uint64_t any = 0;
+      for (size_t i = 0; i < MAX_PERMISSIONS / 64; i++)
+        any |= words[i] & other.words[i];
+      return any != 0;
+    }
+  };
+
+  /**
+   * Build a mask from permission IDs, for handlers to declare what they require.
+   * @param ids IDs of the permissions in the mask.
+   * @return Mask with the bits of the permissions set.
+   */
+  template <typename... Ids>
+  constexpr PermissionMask permission_mask(Ids... ids) {
+    PermissionMask mask;
+    (mask.set(ids), ...);
+    return mask;
+  }
+
+  struct PermissionCacheStats {
+    size_t entries;
+    size_t interned;
+    uint64_t hits;
+    uint64_t misses;
+  };
+
+  // how long a user's permissions are trusted before they are read from the database again
+  extern std::chrono::seconds PERMISSION_CACHE_TTL;
+  extern size_t MAX_PERMISSION_CACHE_SIZE;
+
+  void init_permissions(int verbose);
+  int find_permission(std::string_view name);
+  int get_cached_user_permissions(int user_id, PermissionMask& mask);
+  void cache_user_permissions(int user_id, const PermissionMask& mask);
+  PermissionMask make_permission_mask(const postgres::QueryResult& r, int column, int verbose);
+  PermissionMask get_user_permissions(int user_id, int verbose);
+  net::awaitable<PermissionMask> async_get_user_permissions(int user_id, int verbose);
+  void invalidate_user_permissions(int user_id);
+  PermissionCacheStats get_permission_cache_stats();
+}
+
+#endif
\ No newline at end of file
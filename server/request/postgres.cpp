@@ -1,24 +1,186 @@
 #include "postgres.hpp"
 
 namespace postgres {
+  size_t MIN_POOL_SIZE = 2;
+  size_t MAX_POOL_SIZE = 16;
+  std::chrono::milliseconds POOL_ACQUIRE_TIMEOUT(2000);
+  std::chrono::milliseconds POOL_HEALTH_CHECK_INTERVAL(30000);
+  std::chrono::milliseconds POOL_IDLE_TIMEOUT(300000);
+  size_t MAX_REPLICA_POOL_SIZE = 16;
+  std::chrono::milliseconds REPLICA_RETRY_INTERVAL(5000);
+
   static ConnectionPool* global_pool = nullptr;
-  std::unordered_map<pqxx::connection*, std::chrono::time_point<std::chrono::steady_clock>> last_used;
+  static ConnectionPool* global_replica_pool = nullptr;
+  // steady clock time in milliseconds until which reads skip the replicas
+  static std::atomic<int64_t> replicas_down_until(0);
+  static std::atomic<uint64_t> replica_fallbacks(0);
+
+  // prepared on every connection, synchronous or not, reads may run on a replica
+  const PreparedStatement PREPARED_STATEMENTS[] = {
+    /* Category Queries */
+    {"select_category_names_pagington", STATEMENT_READ,
+      "SELECT category_name, id FROM public.\"Category\" ORDER BY category_name ASC LIMIT $1 OFFSET $2;"},
+    {"create_category", STATEMENT_WRITE,
+      "INSERT INTO public.\"Category\" (category_name) VALUES ($1) "
+      "ON CONFLICT (category_name) DO NOTHING RETURNING id;"},
+    {"delete_category", STATEMENT_WRITE,
+      "DELETE FROM public.\"Category\" WHERE category_name = $1 RETURNING id;"},
+
+    /* Question Queries */
+    {"select_question", STATEMENT_READ,
+      "SELECT id FROM public.\"Question\" WHERE id = $1 LIMIT 1;"},
+    {"create_question", STATEMENT_WRITE,
+      "INSERT INTO public.\"Question\" (question, answers, correct_answer, category_id) "
+      "VALUES ($1, $2, $3, $4);"},
+    {"delete_question", STATEMENT_WRITE,
+      "DELETE FROM public.\"Question\" WHERE id = $1 RETURNING id;"},
+
+    /* Session Queries */
+    {"select_user_id_from_session", STATEMENT_READ,
+      "SELECT user_id FROM public.\"Sessions\" WHERE id = $1 AND expires_at > NOW() AND active = TRUE LIMIT 1;"},
+    {"select_user_data_from_session", STATEMENT_READ,
+      "SELECT user_id, username FROM public.\"Sessions\" WHERE id = $1 AND expires_at > NOW() AND active = TRUE LIMIT 1;"},
+    // written in batches by the session writer as one statement, so a batch is a single round trip.
+    // Sessions come in as a JSON array so each field takes the type of its column, and a session
+    // invalidated in the batch that creates it is inserted inactive
+    {"write_sessions", STATEMENT_WRITE,
+      "WITH invalidated AS ("
+      "UPDATE public.\"Sessions\" SET active = FALSE WHERE id = ANY($2) RETURNING id"
+      "), created AS ("
+      "INSERT INTO public.\"Sessions\" (id, user_id, username, created_at, last_accessed, expires_at, ip_address, active) "
+      "SELECT s.id, s.user_id, s.username, CURRENT_TIMESTAMP, CURRENT_TIMESTAMP, "
+      "CURRENT_TIMESTAMP + ((e->>'duration') || ' seconds')::interval, s.ip_address, s.id <> ALL($2) "
+      "FROM json_array_elements($1::json) e, json_populate_record(NULL::public.\"Sessions\", e) s "
+      "RETURNING id"
+      ") SELECT (SELECT count(*) FROM created), (SELECT count(*) FROM invalidated);"},
+
+    /* User Queries */
+    {"select_credentials", STATEMENT_READ,
+      "SELECT id, password FROM public.\"Users\" WHERE username = $1 LIMIT 1;"},
+    {"select_username_from_id", STATEMENT_READ,
+      "SELECT username from public.\"Users\" WHERE id = $1 LIMIT 1;"},
+    {"select_permissions", STATEMENT_READ,
+      "SELECT permission_name FROM public.\"Permissions\";"},
+    {"get_user_permissions", STATEMENT_READ,
+      "SELECT p.id, p.permission_name FROM public.\"UserPermissions\" up "
+      "JOIN public.\"Permissions\" p ON up.permission_id = p.id WHERE up.user_id = $1;"},
+    {"select_session_permissions", STATEMENT_READ,
+      "SELECT p.id, p.permission_name FROM public.\"Sessions\" s "
+      "JOIN public.\"UserPermissions\" up ON up.user_id = s.user_id "
+      "JOIN public.\"Permissions\" p ON up.permission_id = p.id "
+      "WHERE s.id = $1 AND s.expires_at > NOW() AND s.active = TRUE;"}
+  };
+  const size_t PREPARED_STATEMENT_COUNT = sizeof(PREPARED_STATEMENTS) / sizeof(PREPARED_STATEMENTS[0]);
 
   /**
-   * Create a new connection for the connection pool.
-   * @return New connection.
+   * Build the libpq connection string from the config.
+   * @return Connection string.
    */
-  pqxx::connection* ConnectionPool::create_new_connection() {
-    auto c = new pqxx::connection(
-      "user=" + std::string(TRIVIA_DB_USERNAME) +
+  std::string connection_string() {
+    return "user=" + std::string(TRIVIA_DB_USERNAME) +
       " password=" + std::string(TRIVIA_DB_PASSWORD) +
       " host=" + std::string(TRIVIA_DB_HOST) +
       " port=" + std::string(TRIVIA_DB_PORT) +
       " dbname=" + std::string(TRIVIA_DB_NAME) +
       " target_session_attrs=read-write" +
       " keepalives=1" +
-      " keepalives_idle=30"
-    );
+      " keepalives_idle=30";
+  }
+
+  /**
+   * Build the libpq connection string for the read replicas from the config. libpq tries the
+   * hosts in order and prefers one in hot standby, so a promoted replica or the primary listed
+   * among them still answers reads.
+   *
+   * @return Connection string, empty if no replicas are configured.
+   */
+  std::string replica_connection_string() {
+    if (!has_replicas())
+      return "";
+    return "user=" + std::string(TRIVIA_DB_USERNAME) +
+      " password=" + std::string(TRIVIA_DB_PASSWORD) +
+      " host=" + std::string(TRIVIA_DB_REPLICA_HOSTS) +
+      " port=" + std::string(TRIVIA_DB_REPLICA_PORT) +
+      " dbname=" + std::string(TRIVIA_DB_NAME) +
+      " target_session_attrs=prefer-standby" +
+      " connect_timeout=2" +
+      " keepalives=1" +
+      " keepalives_idle=30";
+  }
+
+  /**
+   * Look up whether a prepared statement only reads.
+   * @param statement Name of the prepared statement.
+   * @return Target of the statement, STATEMENT_WRITE if it isn't known.
+   */
+  StatementTarget statement_target(const char * statement) {
+    std::string_view name(statement);
+    for (size_t i = 0; i < PREPARED_STATEMENT_COUNT; i++) {
+      if (name == PREPARED_STATEMENTS[i].name)
+        return PREPARED_STATEMENTS[i].target;
+    }
+    return STATEMENT_WRITE;
+  }
+
+  /**
+   * Check if read replicas are configured.
+   * @return 1 if they are, 0 otherwise.
+   */
+  int has_replicas() {
+    return TRIVIA_DB_REPLICA_HOSTS[0] != '\0';
+  }
+
+  /**
+   * Check if reads should be sent to the replicas, which they aren't for a while after a replica failed.
+   * @return 1 if reads can go to the replicas, 0 if they go to the primary.
+   */
+  int replicas_available() {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    return has_replicas() && now >= replicas_down_until.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Send reads to the primary for REPLICA_RETRY_INTERVAL, after a replica couldn't be reached.
+   */
+  void mark_replicas_down() {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+    replicas_down_until.store(now + REPLICA_RETRY_INTERVAL.count(), std::memory_order_relaxed);
+  }
+
+  /**
+   * Count a read that was meant for a replica but ran on the primary.
+   */
+  void record_replica_fallback() {
+    replica_fallbacks.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  /**
+   * Send reads to the primary for a while after a replica failed one.
+   * @param statement Name of the prepared statement the replica failed.
+   * @param e Why the replica failed it.
+   */
+  void fall_back_to_primary(const char * statement, const std::exception& e) {
+    std::cerr << "Read replica failed " << statement << ", reading from the primary: " << e.what() << std::endl;
+    mark_replicas_down();
+    record_replica_fallback();
+  }
+
+  /**
+   * Get the number of reads that fell back to the primary.
+   * @return Number of fallbacks.
+   */
+  uint64_t get_replica_fallbacks() {
+    return replica_fallbacks.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Create a new connection for the connection pool.
+   * @return New connection.
+   */
+  pqxx::connection* ConnectionPool::create_new_connection() {
+    auto c = new pqxx::connection(conninfo);
 
     if (!c->is_open()) {
       delete c;
@@ -26,129 +188,335 @@ namespace postgres {
     }
 
     pqxx::work txn(*c);
+    for (size_t i = 0; i < PREPARED_STATEMENT_COUNT; i++) {
+      txn.conn().prepare(PREPARED_STATEMENTS[i].name, PREPARED_STATEMENTS[i].sql);
+    }
+    txn.commit();
+    return c;
+  }
 
-    /* Category Queries */
-    txn.conn().prepare("select_category_names_pagington",
-      "SELECT category_name, id FROM public.\"Category\" ORDER BY category_name ASC LIMIT $1 OFFSET $2;");
-    txn.conn().prepare("create_category", 
-      "INSERT INTO public.\"Category\" (category_name) VALUES ($1) "
-      "ON CONFLICT (category_name) DO NOTHING RETURNING id;");
-    txn.conn().prepare("delete_category", 
-      "DELETE FROM public.\"Category\" WHERE category_name = $1 RETURNING id;");
+  /**
+   * Lease a connection that goes back to its pool when the lease is destroyed.
+   * @param pool Pool the connection came from.
+   * @param c Connection to lease.
+   */
+  ConnectionLease::ConnectionLease(ConnectionPool& pool, pqxx::connection* c) : pool(&pool), c(c) {}
 
-    /* Question Queries */
-    txn.conn().prepare("select_question", 
-      "SELECT id FROM public.\"Question\" WHERE id = $1 LIMIT 1;");
-    txn.conn().prepare("create_question", 
-      "INSERT INTO public.\"Question\" (question, answers, correct_answer, category_id) "
-      "VALUES ($1, $2, $3, $4);");
-    txn.conn().prepare("delete_question", 
-      "DELETE FROM public.\"Question\" WHERE id = $1 RETURNING id;");
+  ConnectionLease::~ConnectionLease() {
+    release();
+  }
 
-    /* Session Queries */
-    txn.conn().prepare("select_user_id_from_session",
-      "SELECT user_id FROM public.\"Sessions\" WHERE id = $1 AND expires_at > NOW() AND active = TRUE LIMIT 1;");
-    txn.conn().prepare("select_user_data_from_session",
-      "SELECT user_id, username FROM public.\"Sessions\" WHERE id = $1 AND expires_at > NOW() AND active = TRUE LIMIT 1;");
-    txn.conn().prepare("invalidate_session",
-      "UPDATE public.\"Sessions\" SET active = FALSE WHERE id = $1;");
-    txn.conn().prepare("set_session_id",
-      "INSERT INTO public.\"Sessions\" (id, user_id, username, created_at, last_accessed, expires_at, ip_address, active) "
-      "VALUES ($1, $2, $3, CURRENT_TIMESTAMP, CURRENT_TIMESTAMP, CURRENT_TIMESTAMP + ($4 || ' seconds')::interval, $5, TRUE) "
-      "RETURNING id;");
+  ConnectionLease::ConnectionLease(ConnectionLease&& other) noexcept : pool(other.pool), c(other.c) {
+    other.c = nullptr;
+  }
 
-    /* User Queries */
-    txn.conn().prepare("select_user_id",
-      "SELECT id from public.\"Users\" WHERE username = $1 LIMIT 1;");
-    txn.conn().prepare("select_username_from_id",
-      "SELECT username from public.\"Users\" WHERE id = $1 LIMIT 1;");
-    txn.conn().prepare("select_password", 
-      "SELECT password FROM public.\"Users\" WHERE username = $1 LIMIT 1;");
-    txn.conn().prepare("get_user_permissions",
-      "SELECT p.id, p.permission_name FROM public.\"UserPermissions\" up "
-      "JOIN public.\"Permissions\" p ON up.permission_id = p.id WHERE up.user_id = $1;");
+  ConnectionLease& ConnectionLease::operator=(ConnectionLease&& other) noexcept {
+    if (this != &other) {
+      release();
+      pool = other.pool;
+      c = other.c;
+      other.c = nullptr;
+    }
+    return *this;
+  }
 
-    txn.commit();
+  pqxx::connection& ConnectionLease::operator*() const {
+    return *c;
+  }
+
+  pqxx::connection* ConnectionLease::operator->() const {
     return c;
   }
 
   /**
-   * Create a new connection pool with a given size.
-   * @param size Size of the connection pool.
+   * Give the connection back to the pool before the lease goes out of scope.
+   * Does nothing if it was already given back.
    */
-  ConnectionPool::ConnectionPool(int size) : max_size(size) {
-    for (int i = 0; i < size; ++i) {
-      pool.push(create_new_connection());
+  void ConnectionLease::release() {
+    if (c) {
+      pool->release(c);
+      c = nullptr;
     }
   }
 
   /**
-   * Destroy the connection pool and free all connections.
+   * Create a new connection pool, open min_size connections and start the health check thread.
+   * @param conninfo libpq connection string of the database.
+   * @param min_size Number of connections kept open even when idle.
+   * @param max_size Most connections the pool opens under load.
+   * @param acquire_timeout How long acquire waits for a connection before giving up.
+   * @param check_interval How often idle connections are validated and the pool is resized.
+   * @param idle_timeout How long a connection above min_size may sit idle before it is closed.
+   */
+  ConnectionPool::ConnectionPool(std::string conninfo, size_t min_size, size_t max_size, std::chrono::milliseconds acquire_timeout,
+    std::chrono::milliseconds check_interval, std::chrono::milliseconds idle_timeout)
+    : conninfo(std::move(conninfo)), min_size(min_size), max_size(std::max(max_size, std::max<size_t>(min_size, 1))), open_c(0), waiting(0),
+      acquire_timeout(acquire_timeout), check_interval(check_interval), idle_timeout(idle_timeout),
+      acquired(0), timeouts(0), created(0), closed(0), failed_checks(0), wait_us(0), max_wait_us(0), stopping(false) {
+    auto now = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < min_size; ++i) {
+      idle.push_back({create_new_connection(), now});
+      open_c++;
+      created++;
+    }
+    checker = std::thread([this] { run_checker(); });
+  }
+
+  /**
+   * Stop the health check thread and close the idle connections.
    */
   ConnectionPool::~ConnectionPool() {
-    while (!pool.empty()) {
-      delete pool.front();
-      pool.pop();
+    {
+      std::lock_guard<std::mutex> lock(checker_mutex);
+      stopping = true;
+    }
+    checker_cv.notify_all();
+    checker.join();
+
+    for (const IdleConnection& entry : idle) {
+      delete entry.c;
     }
   }
 
   /**
    * Validate a connection by executing a simple query.
    * @param conn Connection to validate.
+   * @return 1 if the connection works, 0 otherwise.
    */
   int ConnectionPool::validate_connection(pqxx::connection* c) {
     try {
       pqxx::work txn(*c);
       txn.exec("SELECT 1");
       txn.commit();
-      return true;
+      return 1;
     } catch (...) {
-      return false;
+      return 0;
     }
   }
 
   /**
-   * Acquire a connection from the pool.
+   * Close a connection that is no longer counted as open and let a waiting caller open another.
+   * @param c Connection to close.
+   */
+  void ConnectionPool::close_connection(pqxx::connection* c) {
+    delete c;
+    closed++;
+    pool_cv.notify_one();
+  }
+
+  /**
+   * Add the time a caller waited for a connection to the stats.
+   * @param wait Time spent waiting.
+   */
+  void ConnectionPool::record_wait(std::chrono::steady_clock::duration wait) {
+    uint64_t us = std::chrono::duration_cast<std::chrono::microseconds>(wait).count();
+    wait_us += us;
+    uint64_t max = max_wait_us.load(std::memory_order_relaxed);
+    while (us > max && !max_wait_us.compare_exchange_weak(max, us, std::memory_order_relaxed)) {}
+  }
+
+  /**
+   * Acquire a connection from the pool, waiting up to the pool's acquire timeout.
    * @return Connection from the pool.
+   * @throws PoolTimeoutError if no connection frees up in time.
    */
   pqxx::connection* ConnectionPool::acquire() {
+    return acquire(acquire_timeout);
+  }
+
+  /**
+   * Acquire a connection from the pool. The most recently used idle connection is handed out
+   * as it is, validation is left to the health check thread. When none is idle and the pool is
+   * below max_size a new connection is opened, outside of the pool lock so other threads can
+   * keep acquiring and releasing connections meanwhile.
+   *
+   * @param timeout How long to wait for a connection.
+   * @return Connection from the pool.
+   * @throws PoolTimeoutError if no connection frees up in time.
+   */
+  pqxx::connection* ConnectionPool::acquire(std::chrono::milliseconds timeout) {
+    auto start = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(pool_mutex);
+    if (idle.empty() && open_c >= max_size) {
+      waiting++;
+      int available = pool_cv.wait_until(lock, start + timeout, [this] { return !idle.empty() || open_c < max_size; });
+      waiting--;
+      record_wait(std::chrono::steady_clock::now() - start);
+      if (!available) {
+        timeouts++;
+        throw PoolTimeoutError();
+      }
+    }
+    acquired++;
+
+    if (!idle.empty()) {
+      pqxx::connection* c = idle.back().c;
+      idle.pop_back();
+      return c;
+    }
+
+    // grow the pool, the slot is taken before unlocking so it can't go past max_size
+    open_c++;
+    lock.unlock();
+    try {
+      pqxx::connection* c = create_new_connection();
+      created++;
+      return c;
+    } catch (...) {
+      lock.lock();
+      open_c--;
+      lock.unlock();
+      pool_cv.notify_one();
+      throw;
+    }
+  }
+
+  /**
+   * Release a connection back to the pool. Connections that were broken while leased are
+   * closed instead, the pool opens a new one when it needs it.
+   *
+   * @param c Connection to release.
+   */
+  void ConnectionPool::release(pqxx::connection* c) {
     std::unique_lock<std::mutex> lock(pool_mutex);
-    pool_cv.wait(lock, [this] { return !pool.empty(); });
+    if (!c->is_open()) {
+      open_c--;
+      lock.unlock();
+      close_connection(c);
+      return;
+    }
+    idle.push_back({c, std::chrono::steady_clock::now()});
+    lock.unlock();
+    pool_cv.notify_one();
+  }
 
-    auto c = pool.front();
-    pool.pop();
+  /**
+   * Lease a connection from the pool, see acquire.
+   * @return Lease that releases the connection when destroyed.
+   * @throws PoolTimeoutError if no connection frees up in time.
+   */
+  ConnectionLease ConnectionPool::lease() {
+    return ConnectionLease(*this, acquire());
+  }
 
+  /**
+   * Check the idle connections and resize the pool. Connections idle past the idle timeout are
+   * closed while the pool is above min_size, the ones idle for a check interval are validated
+   * and closed if they fail, and new connections are opened up to min_size. Connections being
+   * checked are taken out of the pool so no query runs under the pool lock.
+   */
+  void ConnectionPool::check_connections() {
     auto now = std::chrono::steady_clock::now();
+    std::vector<pqxx::connection*> expired;
+    std::vector<IdleConnection> unchecked;
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex);
+      while (!idle.empty() && open_c > min_size && now - idle.front().last_used >= idle_timeout) {
+        expired.push_back(idle.front().c);
+        idle.pop_front();
+        open_c--;
+      }
+      // idle is ordered by last use, so the connections due for a check are at the front
+      while (!idle.empty() && now - idle.front().last_used >= check_interval) {
+        unchecked.push_back(idle.front());
+        idle.pop_front();
+      }
+    }
+
+    for (pqxx::connection* c : expired) {
+      close_connection(c);
+    }
 
-    // check if the connection is still valid every minute
-    if (last_used.find(c) == last_used.end() || 
-      std::chrono::duration_cast<std::chrono::minutes>(now - last_used[c]).count() > 1) {
-      if (!validate_connection(c)) {
-        delete c;
+    std::vector<IdleConnection> healthy;
+    for (const IdleConnection& entry : unchecked) {
+      if (validate_connection(entry.c)) {
+        healthy.push_back(entry);
+        continue;
+      }
+      failed_checks++;
+      {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        open_c--;
+      }
+      close_connection(entry.c);
+    }
+
+    if (!healthy.empty()) {
+      {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        idle.insert(idle.begin(), healthy.begin(), healthy.end());
+      }
+      pool_cv.notify_all();
+    }
+
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (open_c >= min_size)
+          return;
+        open_c++;
+      }
+
+      pqxx::connection* c = nullptr;
+      try {
         c = create_new_connection();
+        created++;
+      } catch (const std::exception &e) {
+        std::cerr << "Error reopening database connection: " << e.what() << std::endl;
+      }
+
+      {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (c)
+          idle.push_back({c, std::chrono::steady_clock::now()});
+        else
+          open_c--;
       }
+      pool_cv.notify_one();
+      if (!c)
+        return;
     }
+  }
 
-    last_used[c] = now;
-    return c;
+  /**
+   * Check the pool every check interval until it is destroyed.
+   */
+  void ConnectionPool::run_checker() {
+    std::unique_lock<std::mutex> lock(checker_mutex);
+    while (!checker_cv.wait_for(lock, check_interval, [this] { return stopping; })) {
+      lock.unlock();
+      check_connections();
+      lock.lock();
+    }
   }
 
   /**
-   * Release a connection back to the pool.
-   * @param c Connection to release.
+   * Get the size, utilization and wait statistics of the pool.
+   * @return Snapshot of the statistics.
    */
-  void ConnectionPool::release(pqxx::connection* c) {
+  ConnectionPoolStats ConnectionPool::get_stats() {
     std::lock_guard<std::mutex> lock(pool_mutex);
-    pool.push(c);
-    pool_cv.notify_one();
+    return {open_c, idle.size(), open_c - idle.size(), waiting, min_size, max_size,
+      acquired.load(), timeouts.load(), created.load(), closed.load(), failed_checks.load(),
+      wait_us.load(), max_wait_us.load()};
   }
 
   /**
-   * Initialize the global connection pool.
+   * Initialize the global connection pool, and the replica pool if replicas are configured.
+   * The replica pool starts empty and opens connections as reads come in, so the server
+   * starts with its replicas down.
+   *
+   * @param min_size Number of connections kept open even when idle.
+   * @param max_size Most connections the pool opens under load.
    */
-  void init_connection() {
+  void init_connection(size_t min_size, size_t max_size) {
     if (!global_pool) {
-      global_pool = new ConnectionPool(5);
+      global_pool = new ConnectionPool(connection_string(), min_size, max_size,
+        POOL_ACQUIRE_TIMEOUT, POOL_HEALTH_CHECK_INTERVAL, POOL_IDLE_TIMEOUT);
+    }
+    if (!global_replica_pool && has_replicas()) {
+      global_replica_pool = new ConnectionPool(replica_connection_string(), 0, MAX_REPLICA_POOL_SIZE,
+        POOL_ACQUIRE_TIMEOUT, POOL_HEALTH_CHECK_INTERVAL, POOL_IDLE_TIMEOUT);
     }
   }
 
@@ -162,4 +530,33 @@ namespace postgres {
     }
     return *global_pool;
   }
-}
+
+  /**
+   * Get the global replica connection pool.
+   * @return Replica connection pool, nullptr if no replicas are configured.
+   */
+  ConnectionPool* get_replica_connection_pool() {
+    return global_replica_pool;
+  }
+
+  /**
+   * Lease a connection to run a prepared statement on. Reads go to the replica pool while the
+   * replicas are reachable, everything else and reads the replicas couldn't take go to the
+   * primary. Only a failed lease falls back, reads should use exec_prepared, which also runs
+   * the statement again on the primary if the replica connection breaks.
+   *
+   * @param statement Name of the prepared statement.
+   * @return Lease of a connection from the replica or primary pool.
+   * @throws PoolTimeoutError if no primary connection frees up in time.
+   */
+  ConnectionLease lease_connection(const char * statement) {
+    if (global_replica_pool && statement_target(statement) == STATEMENT_READ && replicas_available()) {
+      try {
+        return global_replica_pool->lease();
+      } catch (const std::exception &e) {
+        fall_back_to_primary(statement, e);
+      }
+    }
+    return get_connection_pool().lease();
+  }
+}
\ No newline at end of file
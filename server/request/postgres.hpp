@@ -4,35 +4,194 @@
 #include <pqxx/pqxx>
 #include <iostream>
 #include <sstream>
-#include <queue>
+#include <string>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <condition_variable>
+#include <stdexcept>
+#include <thread>
 
 #include "config.h"
 
 namespace postgres {
+  // where a statement may run, writes always go to the primary
+  enum StatementTarget {
+    STATEMENT_READ,
+    STATEMENT_WRITE
+  };
+
+  struct PreparedStatement {
+    const char * name;
+    StatementTarget target;
+    const char * sql;
+  };
+
+  extern const PreparedStatement PREPARED_STATEMENTS[];
+  extern const size_t PREPARED_STATEMENT_COUNT;
+
+  /**
+   * Thrown from ConnectionPool::acquire when no connection frees up before the deadline.
+   */
+  struct PoolTimeoutError : std::runtime_error {
+    PoolTimeoutError() : std::runtime_error("Timed out waiting for a database connection") {}
+  };
+
+  struct ConnectionPoolStats {
+    size_t size;           // open connections, idle or leased
+    size_t idle;
+    size_t in_use;
+    size_t waiting;        // callers blocked in acquire
+    size_t min_size;
+    size_t max_size;
+    uint64_t acquired;
+    uint64_t timeouts;
+    uint64_t created;
+    uint64_t closed;       // closed for being idle too long or failing a health check
+    uint64_t failed_checks;
+    uint64_t wait_us;      // total time callers spent waiting for a connection
+    uint64_t max_wait_us;
+  };
+
+  class ConnectionPool;
+
+  /**
+   * Connection leased from a pool, given back when the lease is released or destroyed so an
+   * exception between acquiring and releasing can't leak it.
+   */
+  class ConnectionLease {
+  private:
+    ConnectionPool* pool;
+    pqxx::connection* c;
+  public:
+    ConnectionLease(ConnectionPool& pool, pqxx::connection* c);
+    ~ConnectionLease();
+
+    ConnectionLease(ConnectionLease&& other) noexcept;
+    ConnectionLease& operator=(ConnectionLease&& other) noexcept;
+    ConnectionLease(const ConnectionLease&) = delete;
+    ConnectionLease& operator=(const ConnectionLease&) = delete;
+
+    pqxx::connection& operator*() const;
+    pqxx::connection* operator->() const;
+    void release();
+  };
+
+  /**
+   * Pool of synchronous connections that keeps between min_size and max_size of them open. It
+   * grows when every connection is leased, and a background thread validates idle connections,
+   * closes the ones idle past the idle timeout and reopens connections up to min_size, so
+   * acquire never runs a query of its own. Callers wait for a connection up to a deadline.
+   */
   class ConnectionPool {
   private:
-    std::queue<pqxx::connection*> pool;
+    struct IdleConnection {
+      pqxx::connection* c;
+      std::chrono::steady_clock::time_point last_used;
+    };
+
+    std::string conninfo;
+    std::deque<IdleConnection> idle; // least recently used at the front
     std::mutex pool_mutex;
     std::condition_variable pool_cv;
-    int max_size;
-    
+    size_t min_size;
+    size_t max_size;
+    size_t open_c;                   // idle, leased or being opened
+    size_t waiting;
+    std::chrono::milliseconds acquire_timeout;
+    std::chrono::milliseconds check_interval;
+    std::chrono::milliseconds idle_timeout;
+    std::atomic<uint64_t> acquired;
+    std::atomic<uint64_t> timeouts;
+    std::atomic<uint64_t> created;
+    std::atomic<uint64_t> closed;
+    std::atomic<uint64_t> failed_checks;
+    std::atomic<uint64_t> wait_us;
+    std::atomic<uint64_t> max_wait_us;
+
+    std::mutex checker_mutex;
+    std::condition_variable checker_cv;
+    bool stopping;
+    std::thread checker;
+
     pqxx::connection* create_new_connection();
     int validate_connection(pqxx::connection* c);
+    void close_connection(pqxx::connection* c);
+    void record_wait(std::chrono::steady_clock::duration wait);
+    void run_checker();
   public:
-    explicit ConnectionPool(int size);
+    ConnectionPool(std::string conninfo, size_t min_size, size_t max_size, std::chrono::milliseconds acquire_timeout,
+      std::chrono::milliseconds check_interval, std::chrono::milliseconds idle_timeout);
     ~ConnectionPool();
 
     ConnectionPool(const ConnectionPool&) = delete;
     ConnectionPool& operator=(const ConnectionPool&) = delete;
 
     pqxx::connection* acquire();
+    pqxx::connection* acquire(std::chrono::milliseconds timeout);
     void release(pqxx::connection* c);
+    ConnectionLease lease();
+    void check_connections();
+    ConnectionPoolStats get_stats();
   };
 
-  void init_connection();
+  extern size_t MIN_POOL_SIZE;
+  extern size_t MAX_POOL_SIZE;
+  extern std::chrono::milliseconds POOL_ACQUIRE_TIMEOUT;
+  extern std::chrono::milliseconds POOL_HEALTH_CHECK_INTERVAL;
+  extern std::chrono::milliseconds POOL_IDLE_TIMEOUT;
+  extern size_t MAX_REPLICA_POOL_SIZE;
+  extern std::chrono::milliseconds REPLICA_RETRY_INTERVAL;
+
+  std::string connection_string();
+  std::string replica_connection_string();
+  StatementTarget statement_target(const char * statement);
+  int has_replicas();
+  int replicas_available();
+  void mark_replicas_down();
+  void record_replica_fallback();
+  void fall_back_to_primary(const char * statement, const std::exception& e);
+  uint64_t get_replica_fallbacks();
+
+  void init_connection(size_t min_size, size_t max_size);
   ConnectionPool& get_connection_pool();
+  ConnectionPool* get_replica_connection_pool();
+  ConnectionLease lease_connection(const char * statement);
+
+  /**
+   * Run a prepared statement on the pool it belongs to, like async_query. Reads go to the
+   * replicas while they are reachable and run again on the primary if the replica can't be
+   * leased or its connection breaks. A single statement needs no transaction, so it runs
+   * without the BEGIN and COMMIT round trips.
+   *
+   * @param statement Name of the prepared statement.
+   * @param params Parameters of the statement.
+   * @return Result of the statement.
+   * @throws PoolTimeoutError if no primary connection frees up in time, pqxx errors if the statement fails.
+   */
+  template <typename... Args>
+  pqxx::result exec_prepared(const char * statement, const Args&... params) {
+    ConnectionPool* replicas = get_replica_connection_pool();
+    if (replicas && statement_target(statement) == STATEMENT_READ && replicas_available()) {
+      try {
+        ConnectionLease c = replicas->lease();
+        pqxx::nontransaction txn(*c);
+        return txn.exec_prepared(statement, params...);
+      } catch (const pqxx::sql_error&) {
+        // the statement itself failed, the primary would turn it down the same way
+        throw;
+      } catch (const std::exception& e) {
+        fall_back_to_primary(statement, e);
+      }
+    }
+
+    ConnectionLease c = get_connection_pool().lease();
+    pqxx::nontransaction txn(*c);
+    return txn.exec_prepared(statement, params...);
+  }
 }
 
 #endif
@@ -4,97 +4,128 @@ using namespace postgres;
 namespace request {
   /* caching for session data */
   size_t MAX_CACHE_SIZE = 1000;
+  size_t SESSION_CACHE_SHARDS = 16;
   int CACHE_TTL_SECONDS = 60;
-  std::mutex cache_mutex;
-  std::unordered_map<std::string_view, CachedUserData> session_cache;
+  size_t INVALID_SESSION_CACHE_SIZE = 4096;
+  int INVALID_SESSION_TTL_SECONDS = 30;
+
+  static std::atomic<uint64_t> empty_session_lookups{0};
+  static std::atomic<uint64_t> malformed_session_lookups{0};
+  static std::atomic<uint64_t> database_session_lookups{0};
 
   /**
-   * Clean up the session cache by removing expired entries.
+   * Drop a session from the cache and remember it is gone, so requests still carrying it
+   * don't reach the database.
+   * @param session_id Session ID that is no longer valid.
    */
-  void cleanup_cache() {
-    std::lock_guard<std::mutex> lock(request::cache_mutex);
-    auto now = std::chrono::system_clock::now();
-    
-    for (auto it = request::session_cache.begin(); it != request::session_cache.end();) {
-      if (it->second.expiry < now) {
-        it = request::session_cache.erase(it);
-      } else {
-        ++it;
-      }
+  static void forget_session(std::string_view session_id) {
+    SessionKey key;
+    if (make_session_key(session_id, key)) {
+      get_session_cache().erase(key);
+      get_invalid_session_cache().put(key, {-1, ""}, std::chrono::seconds(INVALID_SESSION_TTL_SECONDS));
     }
+  }
 
-    // if cache is too large, remove the oldest entries
-    if (request::session_cache.size() > request::MAX_CACHE_SIZE) {
-      auto oldest = request::session_cache.begin();
-      for (auto it = request::session_cache.begin(); it != request::session_cache.end(); ++it) {
-        if (it->second.expiry < oldest->second.expiry) {
-          oldest = it;
-        }
-      }
-      request::session_cache.erase(oldest);
+  /**
+   * Look up a session without the database, from the caches or because the ID can't be valid.
+   * @param session_id Session ID to look up.
+   * @param user Set to the user data of the session if it was answered.
+   * @return 1 if the lookup was answered, 0 if it has to go to the database.
+   */
+  static int select_cached_user_data(std::string_view session_id, UserData& user) {
+    user = {-1, ""};
+    // anonymous requests have no cookie, and anything but 32 lowercase hex characters
+    // wasn't handed out by generate_session_id, so neither can be in the database
+    if (session_id.empty()) {
+      empty_session_lookups.fetch_add(1, std::memory_order_relaxed);
+      return 1;
+    }
+    SessionKey key;
+    if (!make_session_key(session_id, key)) {
+      malformed_session_lookups.fetch_add(1, std::memory_order_relaxed);
+      return 1;
     }
+
+    CachedSession cached;
+    if (get_session_cache().get(key, cached)) {
+      user = {cached.user_id, std::move(cached.username)};
+      return 1;
+    }
+    if (get_invalid_session_cache().get(key, cached))
+      return 1;
+
+    database_session_lookups.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  /**
+   * Cache a session the database found.
+   * @param session_id Session ID of the session.
+   * @param user User data of the session.
+   */
+  static void cache_user_data(std::string_view session_id, const UserData& user) {
+    SessionKey key;
+    if (make_session_key(session_id, key))
+      get_session_cache().put(key, {user.user_id, user.username}, std::chrono::seconds(CACHE_TTL_SECONDS));
   }
 
   /**
-   * Invalidate a session by setting it to inactive.
+   * Drop a session the database didn't return and queue it to be marked inactive without
+   * waiting for the write, nothing depends on it landing.
+   * @param session_id Session ID that is no longer valid.
+   */
+  static void expire_session(std::string_view session_id) {
+    forget_session(session_id);
+    get_session_writer().invalidate(std::string(session_id), nullptr);
+  }
+
+  /**
+   * Invalidate a session by setting it to inactive. The caches stop answering for it at once,
+   * and the call returns once the session writer has committed the change.
+   *
    * @param session_id Session ID to invalidate.
    * @param verbose Whether to print messages to stdout.
    */
   void invalidate_session(const std::string_view& session_id, int verbose) {
-    std::lock_guard<std::mutex> lock(cache_mutex);
-    session_cache.erase(session_id);
-    try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      txn.exec_prepared("invalidate_session", session_id);
-      txn.commit();
-      pool.release(c);
+    forget_session(session_id);
 
-    } catch (const std::exception &e) {
-      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
-    } catch (...) {
-      verbose && std::cerr << "Unknown error while executing query" << std::endl;
-    }
+    std::promise<int> written;
+    std::future<int> result = written.get_future();
+    get_session_writer().invalidate(std::string(session_id), [&written](int ok) { written.set_value(ok); });
+    if (!result.get())
+      verbose && std::cerr << "Failed to invalidate session " << session_id << std::endl;
   }
 
   /**
-   * Get the permissions for a user by their ID.
-   * This is used to check if a user has the required permissions to access an endpoint.
-   * @param user_id ID of the user to get the permissions for.
+   * Create a session through the session writer, waiting without blocking until it has been
+   * committed. The session is cached straight away so requests made with it right after login
+   * don't reach the database.
+   *
+   * @param record Session to create.
    * @param verbose Whether to print messages to stdout.
-   * @return Array of permissions for the user.
+   * @return 1 if the session was created, 0 otherwise.
    */
-  UserPermissions get_user_permissions(int user_id, int verbose) {
-    UserPermissions result = {0, nullptr};
-    try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("get_user_permissions", user_id);
-      txn.commit();
-      pool.release(c);
+  net::awaitable<int> async_create_session(SessionRecord record, int verbose) {
+    std::string session_id = record.session_id;
+    cache_user_data(session_id, {record.user_id, record.username});
 
-      if (r.empty()) {
-        verbose && std::cerr << "User with ID " << user_id << " not found" << std::endl;
-        return result;
-      }
+    int ok = co_await net::async_initiate<decltype(net::use_awaitable), void(int)>(
+      [&record](auto handler) {
+        // resumed on the coroutine's executor rather than on the writer thread
+        auto shared = std::make_shared<decltype(handler)>(std::move(handler));
+        get_session_writer().create(std::move(record), [shared](int ok) {
+          auto executor = net::get_associated_executor(*shared);
+          net::post(executor, [shared, ok]() { (*shared)(ok); });
+        });
+      }, net::use_awaitable);
 
-      result.permission_count = r.size();
-      result.permissions = new Permission[r.size()];
-      
-      for (size_t i = 0; i < r.size(); i++) {
-        result.permissions[i].id = r[i][0].as<int>();
-        result.permissions[i].permission_name = r[i][1].c_str();
-      }
-      return result;
-        
-    } catch (const std::exception &e) {
-      verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
-    } catch (...) {
-      verbose && std::cerr << "Unknown error while executing query" << std::endl;
-    }    
-    return result;
+    if (!ok) {
+      verbose && std::cerr << "Failed to create session " << session_id << std::endl;
+      SessionKey key;
+      if (make_session_key(session_id, key))
+        get_session_cache().erase(key);
+    }
+    co_return ok;
   }
 
   /**
@@ -129,46 +160,33 @@ namespace request {
    * @return User data if the session is valid, {-1, ""} otherwise.
    */
   UserData select_user_data_from_session(const std::string_view& session_id, int verbose) {
-    {
-      std::lock_guard<std::mutex> lock(request::cache_mutex);
-      auto it = request::session_cache.find(session_id);
-      if (it != request::session_cache.end()) {
-        auto now = std::chrono::system_clock::now();
-        if (it->second.expiry > now) {
-          return {it->second.user_id, it->second.username};
-        }
-        request::session_cache.erase(it);
-      }
-    }
+    UserData user;
+    if (select_cached_user_data(session_id, user))
+      return user;
 
     try {
-      auto& pool = get_connection_pool();
-      auto c = pool.acquire();
-      pqxx::work txn(*c);
-      pqxx::result r = txn.exec_prepared("select_user_data_from_session", session_id);
-      txn.commit();
-      pool.release(c);
+      pqxx::result r = postgres::exec_prepared("select_user_data_from_session", session_id);
+
+      // a replica may not have replayed a session created moments ago, only the primary can turn it down
+      if (r.empty() && postgres::has_replicas()) {
+        auto primary = get_connection_pool().lease();
+        pqxx::work confirm(*primary);
+        r = confirm.exec_prepared("select_user_data_from_session", session_id);
+        confirm.commit();
+        primary.release();
+      }
 
       if (r.empty()) {
         verbose && std::cerr << "Session ID " << session_id << " not found" << std::endl;
-        request::invalidate_session(session_id, 0);
+        expire_session(session_id);
         return {-1, ""};
       }
 
-      int user_id = std::stoi(r[0][0].c_str());
-      std::string username = r[0][1].c_str();
-      
-      {
-        std::lock_guard<std::mutex> lock(request::cache_mutex);
-        auto expiry = std::chrono::system_clock::now() + std::chrono::seconds(request::CACHE_TTL_SECONDS);
-        request::session_cache[session_id] = {user_id, username, expiry};
-        
-        if (request::session_cache.size() > request::MAX_CACHE_SIZE) {
-          cleanup_cache();
-        }
-      }
-      
-      return {user_id, username};
+      user = {std::stoi(r[0][0].c_str()), r[0][1].c_str()};
+      cache_user_data(session_id, user);
+      return user;
+    } catch (const postgres::PoolTimeoutError&) {
+      throw;
     } catch (const std::exception &e) {
       verbose && std::cerr << "Error executing query: " << e.what() << std::endl;
     } catch (...) {
@@ -177,6 +195,92 @@ namespace request {
     return {-1, ""};
   }
 
+  /**
+   * Select the user data from the session ID on the asynchronous connection pool, so the
+   * calling coroutine is suspended rather than a thread blocked while the database answers.
+   *
+   * @param session_id Session ID to select the user ID from.
+   * @param verbose Whether to print messages to stdout.
+   * @return User data if the session is valid, {-1, ""} otherwise.
+   */
+  net::awaitable<UserData> async_select_user_data_from_session(std::string session_id, int verbose) {
+    UserData user;
+    if (select_cached_user_data(session_id, user))
+      co_return user;
+
+    postgres::QueryResult r = co_await postgres::async_query("select_user_data_from_session", std::vector<std::string>(1, session_id));
+    // a replica may not have replayed a session created moments ago, only the primary can turn it down
+    if (r.ok() && r.rows() == 0 && postgres::has_replicas())
+      r = co_await postgres::get_async_connection_pool().query("select_user_data_from_session", std::vector<std::string>(1, session_id));
+    if (!r.ok()) {
+      verbose && std::cerr << "Error executing query: " << r.error_message() << std::endl;
+      co_return user;
+    }
+
+    if (r.rows() == 0) {
+      verbose && std::cerr << "Session ID " << session_id << " not found" << std::endl;
+      expire_session(session_id);
+      co_return user;
+    }
+
+    user = {std::atoi(std::string(r.get(0, 0)).c_str()), std::string(r.get(0, 1))};
+    cache_user_data(session_id, user);
+    co_return user;
+  }
+
+  /**
+   * Select the user data and permissions of a session. When neither is cached both are read
+   * in one round trip, pipelining the permissions by session ID behind the session lookup.
+   *
+   * @param session_id Session ID to select the user from.
+   * @param verbose Whether to print messages to stdout.
+   * @return User data and permissions if the session is valid, {{-1, ""}, {}} otherwise.
+   */
+  net::awaitable<AuthorizedUser> async_select_authorized_user(std::string session_id, int verbose) {
+    AuthorizedUser authorized;
+    if (select_cached_user_data(session_id, authorized.user)) {
+      if (!get_cached_user_permissions(authorized.user.user_id, authorized.permissions))
+        authorized.permissions = co_await async_get_user_permissions(authorized.user.user_id, verbose);
+      co_return authorized;
+    }
+
+    std::vector<postgres::PipelineQuery> queries;
+    queries.push_back({"select_user_data_from_session", std::vector<std::string>(1, session_id)});
+    queries.push_back({"select_session_permissions", std::vector<std::string>(1, session_id)});
+    std::vector<postgres::QueryResult> r = co_await postgres::async_pipeline(queries);
+    if (r[0].ok() && r[0].rows() == 0 && postgres::has_replicas())
+      r = co_await postgres::get_async_connection_pool().pipeline(std::move(queries));
+    if (!r[0].ok() || !r[1].ok()) {
+      verbose && std::cerr << "Error executing query: " << (r[0].ok() ? r[1] : r[0]).error_message() << std::endl;
+      co_return authorized;
+    }
+
+    if (r[0].rows() == 0) {
+      verbose && std::cerr << "Session ID " << session_id << " not found" << std::endl;
+      expire_session(session_id);
+      co_return authorized;
+    }
+
+    authorized.user = {std::atoi(std::string(r[0].get(0, 0)).c_str()), std::string(r[0].get(0, 1))};
+    authorized.permissions = make_permission_mask(r[1], 1, verbose);
+    cache_user_data(session_id, authorized.user);
+    cache_user_permissions(authorized.user.user_id, authorized.permissions);
+    co_return authorized;
+  }
+
+  /**
+   * Get the counters of session lookups that were answered without the database.
+   * @return Snapshot of the counters.
+   */
+  SessionLookupStats get_session_lookup_stats() {
+    return {
+      empty_session_lookups.load(std::memory_order_relaxed),
+      malformed_session_lookups.load(std::memory_order_relaxed),
+      get_invalid_session_cache().get_stats().hits,
+      database_session_lookups.load(std::memory_order_relaxed)
+    };
+  }
+
    /**
    * Parse a query string into a map of key-value pairs
    * This allows query strings to be extracted from URLS, to be used as parameters.
@@ -308,28 +412,107 @@ namespace request {
   }
 
   /**
-   * Create an OK request response with a given message.
+   * Create a service unavailable response with a given message.
+   * This is sent when the server is too busy to queue the request.
+   *
    * @param message Message to include in the response.
    * @param req Request that caused the error.
    * @return Response with the given message.
    */
-  http::response<http::string_body> make_ok_request_response(
+  http::response<http::string_body> make_service_unavailable_response(
     const std::string& message, const http::request<http::string_body>& req) {
-    
-    http::response<http::string_body> res{http::status::ok, req.version()};
+
+    http::response<http::string_body> res{http::status::service_unavailable, req.version()};
+    res.set(http::field::server, "Beast");
+    res.set(http::field::content_type, "application/json");
+    res.set(http::field::retry_after, "1");
+
+    nlohmann::json error_response = {
+        {"status", "error"},
+        {"message", message}
+    };
+
+    res.body() = error_response.dump();
+    res.keep_alive(req.keep_alive());
+    res.prepare_payload();
+    return res;
+  }
+
+  /**
+   * Create an internal server error response with a given message.
+   * @param message Message to include in the response.
+   * @param req Request that caused the error.
+   * @return Response with the given message.
+   */
+  http::response<http::string_body> make_internal_server_error_response(
+    const std::string& message, const http::request<http::string_body>& req) {
+
+    http::response<http::string_body> res{http::status::internal_server_error, req.version()};
     res.set(http::field::server, "Beast");
     res.set(http::field::content_type, "application/json");
 
-    auto message_json = nlohmann::json::parse(message);
-    nlohmann::json ok_response = {
-        {"status", "ok"},
-        {"message", message_json}
+    nlohmann::json error_response = {
+        {"status", "error"},
+        {"message", message}
     };
 
-    res.body() = ok_response.dump();
+    res.body() = error_response.dump();
+    res.keep_alive(req.keep_alive());
+    res.prepare_payload();
+    return res;
+  }
+
+  /**
+   * Make an OK response from a body that is already the complete JSON response, such as
+   * a cached category, so it is copied as it is instead of being parsed and dumped again.
+   *
+   * @param body Complete JSON response body.
+   * @param req HTTP request object.
+   * @return HTTP response object.
+   */
+  http::response<http::string_body> make_ok_body_response(
+    std::string body, const http::request<http::string_body>& req) {
+
+    http::response<http::string_body> res{http::status::ok, req.version()};
+    res.set(http::field::server, "Beast");
+    res.set(http::field::content_type, "application/json");
+    res.body() = std::move(body);
     res.keep_alive(req.keep_alive());
     res.prepare_payload();
 
     return res;
   }
+
+  /**
+   * Create an OK response with a message written straight into the body, between the
+   * preformatted envelope.
+   *
+   * @param write_message Writes the message JSON to the end of the body it is given.
+   * @param req Request being responded to.
+   * @param size_hint Expected size of the message, to size the body up front.
+   * @return Response with the written message.
+   */
+  http::response<http::string_body> make_ok_written_response(
+    const std::function<void(std::string&)>& write_message, const http::request<http::string_body>& req, size_t size_hint) {
+
+    std::string body;
+    body.reserve(OK_ENVELOPE_PREFIX.size() + size_hint + OK_ENVELOPE_SUFFIX.size());
+    body.append(OK_ENVELOPE_PREFIX);
+    write_message(body);
+    body.append(OK_ENVELOPE_SUFFIX);
+    return make_ok_body_response(std::move(body), req);
+  }
+
+  /**
+   * Create an OK response with a given message, serialized once and compactly.
+   * @param message Message to include in the response.
+   * @param req Request being responded to.
+   * @return Response with the given message.
+   */
+  http::response<http::string_body> make_ok_response(
+    const nlohmann::json& message, const http::request<http::string_body>& req) {
+    return make_ok_written_response([&](std::string& out) {
+      out += message.dump();
+    }, req, 0);
+  }
 }
\ No newline at end of file
@@ -11,46 +11,58 @@
 #include <optional>
 #include <iostream>
 #include <chrono>
+#include <functional>
+#include <mutex>
+#include <atomic>
 #include <unordered_map>
+#include <future>
+#include <memory>
+#include <boost/asio/post.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/associated_executor.hpp>
 
 #include "postgres.hpp"
+#include "async_postgres.hpp"
+#include "envelope.hpp"
+#include "session_cache.hpp"
+#include "permissions.hpp"
+#include "session_writer.hpp"
 
 namespace http = boost::beast::http;
 
 namespace request {
-  struct Permission {
-    int id;
-    std::string permission_name;
-  };
-
-  struct UserPermissions {
-    int permission_count;
-    Permission * permissions;
-  };
-
   struct UserData {
     int user_id;
     std::string username;
   };
 
-  struct CachedUserData {
-    int user_id;
-    std::string username;
-    std::chrono::system_clock::time_point expiry;
+  struct AuthorizedUser {
+    UserData user;
+    PermissionMask permissions;
+  };
+
+  struct SessionLookupStats {
+    uint64_t empty;          // requests without a session ID
+    uint64_t malformed;      // session IDs generate_session_id couldn't have made
+    uint64_t known_invalid;  // session IDs the database already turned down
+    uint64_t database;       // lookups that went to the database
   };
 
-  // caching for session data
+  // caching for session data, see session_cache.hpp
   extern size_t MAX_CACHE_SIZE;
+  extern size_t SESSION_CACHE_SHARDS;
   extern int CACHE_TTL_SECONDS;
-  extern std::mutex cache_mutex;
-  extern std::unordered_map<std::string_view, CachedUserData> session_cache;
+  extern size_t INVALID_SESSION_CACHE_SIZE;
+  extern int INVALID_SESSION_TTL_SECONDS;
 
   /* session nonsense */
-  void cleanup_cache();
   void invalidate_session(const std::string_view& session_id, int verbose);
-  UserPermissions get_user_permissions(int user_id, int verbose);
+  net::awaitable<int> async_create_session(SessionRecord record, int verbose);
   std::string_view get_session_id_from_cookie(const http::request<http::string_body>& req);
   UserData select_user_data_from_session(const std::string_view& session_id, int verbose);
+  net::awaitable<UserData> async_select_user_data_from_session(std::string session_id, int verbose);
+  net::awaitable<AuthorizedUser> async_select_authorized_user(std::string session_id, int verbose);
+  SessionLookupStats get_session_lookup_stats();
 
   std::map<std::string, std::string> parse_query_string(std::string_view query);
   std::optional<std::string> parse_from_request(const http::request<http::string_body>& req, const std::string& parameter);
@@ -59,6 +71,11 @@ namespace request {
   http::response<http::string_body> make_unauthorized_response(const std::string& message, const http::request<http::string_body>& req);
   http::response<http::string_body> make_bad_request_response(const std::string& message, const http::request<http::string_body>& req);
   http::response<http::string_body> make_too_many_requests_response(const std::string& message, const http::request<http::string_body>& req);
-  http::response<http::string_body> make_ok_request_response(const std::string& message, const http::request<http::string_body>& req);
+  http::response<http::string_body> make_service_unavailable_response(const std::string& message, const http::request<http::string_body>& req);
+  http::response<http::string_body> make_internal_server_error_response(const std::string& message, const http::request<http::string_body>& req);
+  http::response<http::string_body> make_ok_body_response(std::string body, const http::request<http::string_body>& req);
+  http::response<http::string_body> make_ok_written_response(
+    const std::function<void(std::string&)>& write_message, const http::request<http::string_body>& req, size_t size_hint);
+  http::response<http::string_body> make_ok_response(const nlohmann::json& message, const http::request<http::string_body>& req);
 }
 #endif
\ No newline at end of file
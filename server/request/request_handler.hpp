@@ -1,4 +1,8 @@
+#ifndef REQUEST_HANDLER_HPP
+#define REQUEST_HANDLER_HPP
+
 #include <string>
+#include <vector>
 #include <boost/beast/http.hpp>
 
 namespace http = boost::beast::http;
@@ -7,5 +11,11 @@ class RequestHandler {
 public:
   virtual ~RequestHandler() = default;
   virtual std::string get_endpoint() const = 0;
+  // methods the endpoint accepts, anything else gets a 405. empty accepts every method
+  virtual std::vector<http::verb> get_methods() const { return {}; }
+  // 1 if GET responses are the same for every user, so conditional GETs can be answered with a 304
+  virtual int is_cacheable() const { return 0; }
   virtual http::response<http::string_body> handle_request(const http::request<http::string_body>& req, const std::string& ip_address) = 0;
-};
\ No newline at end of file
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,204 @@
+#include "session_cache.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace request {
+  static SessionCache* global_session_cache = nullptr;
+  static SessionCache* global_invalid_session_cache = nullptr;
+
+  /**
+   * Get the value of a lowercase hex digit.
+   * @param c Character to convert.
+   * @return Value of the digit, -1 if it isn't lowercase hex.
+   */
+  static int hex_value(char c) {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    return -1;
+  }
+
+  /**
+   * Convert a session ID to its cache key. Only the lowercase form generate_session_id hands
+   * out is accepted, so every key stands for exactly one session ID in the database.
+   * @param session_id Session ID from the cookie, 32 lowercase hex characters.
+   * @param key Set to the 16 bytes the session ID encodes.
+   * @return 1 if the session ID is 32 lowercase hex characters, 0 otherwise.
+   */
+  int make_session_key(std::string_view session_id, SessionKey& key) {
+    if (session_id.size() != sizeof(key.bytes) * 2)
+      return 0;
+
+    for (size_t i = 0; i < sizeof(key.bytes); i++) {
+      int high = hex_value(session_id[i * 2]);
+      int low = hex_value(session_id[i * 2 + 1]);
+      if (high < 0 || low < 0)
+        return 0;
+      key.bytes[i] = (high << 4) | low;
+    }
+    return 1;
+  }
+
+  /**
+   * Create a session cache.
+   * @param capacity Most sessions to hold, split evenly between the shards.
+   * @param shard_c Number of shards.
+   */
+  SessionCache::SessionCache(size_t capacity, size_t shard_c)
+    : shards(std::make_unique<Shard[]>(std::max<size_t>(1, shard_c))), shard_c(std::max<size_t>(1, shard_c)), capacity(capacity) {
+    for (size_t i = 0; i < this->shard_c; i++) {
+      shards[i].capacity = std::max<size_t>(1, capacity / this->shard_c + (i < capacity % this->shard_c));
+      shards[i].index.reserve(shards[i].capacity);
+    }
+  }
+
+  /**
+   * Get the shard a key belongs to, from the top bits of its hash so the shard doesn't
+   * correlate with the bucket inside the shard's map.
+   * @param key Key to get the shard of.
+   * @return Shard of the key.
+   */
+  SessionCache::Shard& SessionCache::get_shard(const SessionKey& key) const {
+    return shards[(SessionKeyHash{}(key) >> 32) % shard_c];
+  }
+
+  /**
+   * Look up a session, moving it to the front of its shard's LRU list.
+   * @param key Key of the session.
+   * @param session Set to the cached session on a hit.
+   * @return 1 if the session was cached and hasn't expired, 0 otherwise.
+   */
+  int SessionCache::get(const SessionKey& key, CachedSession& session) {
+    Shard& shard = get_shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end()) {
+      shard.misses++;
+      return 0;
+    }
+
+    if (it->second->expiry <= std::chrono::steady_clock::now()) {
+      shard.lru.erase(it->second);
+      shard.index.erase(it);
+      shard.expired++;
+      shard.misses++;
+      return 0;
+    }
+
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    session = it->second->session;
+    shard.hits++;
+    return 1;
+  }
+
+  /**
+   * Cache a session, evicting the least recently used session of the shard if it is full.
+   * @param key Key of the session.
+   * @param session Session to cache.
+   * @param ttl How long the session stays cached.
+   */
+  void SessionCache::put(const SessionKey& key, CachedSession session, std::chrono::seconds ttl) {
+    Shard& shard = get_shard(key);
+    auto expiry = std::chrono::steady_clock::now() + ttl;
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it != shard.index.end()) {
+      it->second->session = std::move(session);
+      it->second->expiry = expiry;
+      shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+      return;
+    }
+
+    if (shard.index.size() >= shard.capacity) {
+      shard.index.erase(shard.lru.back().key);
+      shard.lru.pop_back();
+      shard.evicted++;
+    }
+
+    shard.lru.push_front({key, std::move(session), expiry});
+    shard.index.emplace(key, shard.lru.begin());
+  }
+
+  /**
+   * Remove a session from the cache.
+   * @param key Key of the session.
+   */
+  void SessionCache::erase(const SessionKey& key) {
+    Shard& shard = get_shard(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto it = shard.index.find(key);
+    if (it == shard.index.end())
+      return;
+    shard.lru.erase(it->second);
+    shard.index.erase(it);
+  }
+
+  /**
+   * Remove every session from the cache.
+   */
+  void SessionCache::clear() {
+    for (size_t i = 0; i < shard_c; i++) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      shards[i].lru.clear();
+      shards[i].index.clear();
+    }
+  }
+
+  /**
+   * Get the cache counters, summed over the shards.
+   * @return Snapshot of the counters.
+   */
+  SessionCacheStats SessionCache::get_stats() const {
+    SessionCacheStats stats = {0, capacity, shard_c, 0, 0, 0, 0};
+    for (size_t i = 0; i < shard_c; i++) {
+      std::lock_guard<std::mutex> lock(shards[i].mutex);
+      stats.entries += shards[i].index.size();
+      stats.hits += shards[i].hits;
+      stats.misses += shards[i].misses;
+      stats.expired += shards[i].expired;
+      stats.evicted += shards[i].evicted;
+    }
+    return stats;
+  }
+
+  /**
+   * Initialize the global session caches.
+   * @param capacity Most valid sessions to hold.
+   * @param invalid_capacity Most invalid session IDs to remember.
+   * @param shard_c Number of shards of each cache.
+   */
+  void init_session_cache(size_t capacity, size_t invalid_capacity, size_t shard_c) {
+    if (!global_session_cache)
+      global_session_cache = new SessionCache(capacity, shard_c);
+    if (!global_invalid_session_cache)
+      global_invalid_session_cache = new SessionCache(invalid_capacity, shard_c);
+  }
+
+  /**
+   * Get the global session cache.
+   * @return Global session cache.
+   */
+  SessionCache& get_session_cache() {
+    if (!global_session_cache) {
+      throw std::runtime_error("Session cache not initialized. Call init_session_cache first.");
+    }
+    return *global_session_cache;
+  }
+
+  /**
+   * Get the global cache of session IDs the database turned down, so repeated requests with
+   * the same stale or made up cookie are answered without a query.
+   * @return Global invalid session cache.
+   */
+  SessionCache& get_invalid_session_cache() {
+    if (!global_invalid_session_cache) {
+      throw std::runtime_error("Session cache not initialized. Call init_session_cache first.");
+    }
+    return *global_invalid_session_cache;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#ifndef SESSION_CACHE_HPP
+#define SESSION_CACHE_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace request {
+  /**
+   * Session ID as the 16 bytes its 32 hex characters encode, owned by the cache
+   * rather than pointing into a request.
+   */
+  struct SessionKey {
+    uint8_t bytes[16];
+
+    bool operator==(const SessionKey& other) const {
+      return memcmp(bytes, other.bytes, sizeof(bytes)) == 0;
+    }
+  };
+
+  struct SessionKeyHash {
+    size_t operator()(const SessionKey& key) const {
+      uint64_t low, high;
+      memcpy(&low, key.bytes, 8);
+      memcpy(&high, key.bytes + 8, 8);
+      // session IDs are random, the mixing only guards against ones that aren't
+      uint64_t h = low ^ (high * 0x9E3779B97F4A7C15ull);
+      h ^= h >> 33;
+      h *= 0xFF51AFD7ED558CCDull;
+      h ^= h >> 33;
+      return h;
+    }
+  };
+
+  struct CachedSession {
+    int user_id;
+    std::string username;
+  };
+
+  struct SessionCacheStats {
+    size_t entries;
+    size_t capacity;
+    size_t shards;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t expired;
+    uint64_t evicted;
+  };
+
+  int make_session_key(std::string_view session_id, SessionKey& key);
+
+  /**
+   * Session cache split into shards with their own lock, so lookups for different
+   * sessions rarely contend. Each shard keeps its entries in LRU order in a list indexed
+   * by a hash map, so lookups, inserts and evictions are all O(1). Entries also expire
+   * after their own TTL.
+   */
+  class SessionCache {
+  private:
+    struct Entry {
+      SessionKey key;
+      CachedSession session;
+      std::chrono::steady_clock::time_point expiry;
+    };
+
+    struct Shard {
+      std::mutex mutex;
+      std::list<Entry> lru; // most recently used first
+      std::unordered_map<SessionKey, std::list<Entry>::iterator, SessionKeyHash> index;
+      size_t capacity;
+      uint64_t hits = 0;
+      uint64_t misses = 0;
+      uint64_t expired = 0;
+      uint64_t evicted = 0;
+    };
+
+    std::unique_ptr<Shard[]> shards;
+    size_t shard_c;
+    size_t capacity;
+
+    Shard& get_shard(const SessionKey& key) const;
+  public:
+    SessionCache(size_t capacity, size_t shard_c);
+
+    SessionCache(const SessionCache&) = delete;
+    SessionCache& operator=(const SessionCache&) = delete;
+
+    int get(const SessionKey& key, CachedSession& session);
+    void put(const SessionKey& key, CachedSession session, std::chrono::seconds ttl);
+    void erase(const SessionKey& key);
+    void clear();
+    SessionCacheStats get_stats() const;
+  };
+
+  void init_session_cache(size_t capacity, size_t invalid_capacity, size_t shard_c);
+  SessionCache& get_session_cache();
+  SessionCache& get_invalid_session_cache();
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,242 @@
+#include "session_writer.hpp"
+#include "postgres.hpp"
+
+#include <nlohmann/json.hpp>
+
+namespace request {
+  std::chrono::milliseconds SESSION_WRITE_INTERVAL(0);
+  size_t MAX_SESSION_WRITE_BATCH = 512;
+  int SESSION_WRITE_ATTEMPTS = 3;
+
+  static SessionWriter* global_session_writer = nullptr;
+
+  /**
+   * Create a session writer and start its thread.
+   * @param interval How long to keep collecting writes once one is queued, 0 to write it straight away.
+   * @param max_batch Number of queued writes that gets written without waiting for the interval.
+   */
+  SessionWriter::SessionWriter(std::chrono::milliseconds interval, size_t max_batch)
+    : interval(interval), max_batch(std::max<size_t>(max_batch, 1)), stopping(false),
+      created(0), invalidated(0), coalesced(0), flushes(0), failed(0), rejected(0) {
+    writer = std::thread([this] { run_writer(); });
+  }
+
+  /**
+   * Write everything still queued and stop the writer thread.
+   */
+  SessionWriter::~SessionWriter() {
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex);
+      stopping = true;
+    }
+    writer_cv.notify_all();
+    writer.join();
+  }
+
+  /**
+   * Queue a session to be inserted.
+   * @param record Session to insert.
+   * @param done Called with 1 once the session is committed, 0 if it couldn't be written. May be empty.
+   */
+  void SessionWriter::create(SessionRecord record, std::function<void(int)> done) {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    if (stopping) {
+      lock.unlock();
+      if (done)
+        done(0);
+      return;
+    }
+    creates.push_back({std::move(record), std::move(done)});
+    size_t pending = creates.size() + invalidations.size();
+    lock.unlock();
+    if (pending == 1 || pending >= max_batch)
+      writer_cv.notify_one();
+  }
+
+  /**
+   * Queue a session to be marked inactive. Invalidating a session ID that is already queued
+   * doesn't add another row to the UPDATE.
+   *
+   * @param session_id Session ID to invalidate.
+   * @param done Called with 1 once the invalidation is committed, 0 if it couldn't be written. May be empty.
+   */
+  void SessionWriter::invalidate(std::string session_id, std::function<void(int)> done) {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    if (stopping) {
+      lock.unlock();
+      if (done)
+        done(0);
+      return;
+    }
+    if (!invalidations.insert(std::move(session_id)).second)
+      coalesced.fetch_add(1, std::memory_order_relaxed);
+    if (done)
+      invalidation_waiters.push_back(std::move(done));
+    size_t pending = creates.size() + invalidations.size();
+    lock.unlock();
+    if (pending == 1 || pending >= max_batch)
+      writer_cv.notify_one();
+  }
+
+  /**
+   * Build the row of a session in the JSON the write_sessions statement takes, so each field
+   * takes the type of its column in "Sessions".
+   * @param record Session to insert.
+   * @return Row of the session.
+   */
+  static nlohmann::json make_session_row(const SessionRecord& record) {
+    return {
+      {"id", record.session_id},
+      {"user_id", record.user_id},
+      {"username", record.username},
+      {"duration", record.duration},
+      {"ip_address", record.ip_address}
+    };
+  }
+
+  /**
+   * Run the write_sessions statement, which commits on its own so it costs one round trip.
+   * A failed statement is tried again on another connection.
+   *
+   * @param rows_json Sessions to insert, as a JSON array of rows.
+   * @param ids Session IDs to invalidate.
+   * @param attempts Most times to run the statement.
+   * @return 1 if the statement was committed, 0 otherwise.
+   */
+  int SessionWriter::write_sessions(const std::string& rows_json, const std::vector<std::string>& ids, int attempts) {
+    for (int attempt = 1; attempt <= attempts; attempt++) {
+      try {
+        auto c = postgres::lease_connection("write_sessions");
+        // one statement is atomic by itself, a transaction would only add BEGIN and COMMIT round trips
+        pqxx::nontransaction txn(*c);
+        pqxx::result r = txn.exec_prepared("write_sessions", rows_json, ids);
+        c.release();
+
+        flushes.fetch_add(1, std::memory_order_relaxed);
+        created.fetch_add(r[0][0].as<uint64_t>(), std::memory_order_relaxed);
+        invalidated.fetch_add(r[0][1].as<uint64_t>(), std::memory_order_relaxed);
+        return 1;
+      } catch (const std::exception &e) {
+        std::cerr << "Error writing sessions (attempt " << attempt << "): " << e.what() << std::endl;
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Write a batch in one statement, retried up to SESSION_WRITE_ATTEMPTS times, and tell each
+   * caller whether its write was committed. One row the database turns down, like the session
+   * of a user deleted since logging in, fails the whole statement, so a batch that still fails
+   * is written again row by row and only the callers of the rows that fail again get a 0.
+   *
+   * @param batch_creates Sessions to insert.
+   * @param batch_invalidations Session IDs to invalidate.
+   * @param batch_waiters Callbacks waiting on the invalidations.
+   */
+  void SessionWriter::write_batch(std::vector<PendingCreate>& batch_creates,
+    const std::unordered_set<std::string>& batch_invalidations, std::vector<std::function<void(int)>>& batch_waiters) {
+    nlohmann::json rows = nlohmann::json::array();
+    for (const PendingCreate& pending : batch_creates)
+      rows.push_back(make_session_row(pending.record));
+    std::vector<std::string> ids(batch_invalidations.begin(), batch_invalidations.end());
+
+    if (write_sessions(rows.dump(), ids, SESSION_WRITE_ATTEMPTS)) {
+      for (PendingCreate& pending : batch_creates) {
+        if (pending.done)
+          pending.done(1);
+      }
+      for (auto& done : batch_waiters)
+        done(1);
+      return;
+    }
+    failed.fetch_add(1, std::memory_order_relaxed);
+
+    // the inserts go first so the invalidations still find sessions created in the same batch
+    int single = batch_creates.size() + !ids.empty() == 1;
+    for (size_t i = 0; i < batch_creates.size(); i++) {
+      int ok = !single && write_sessions(nlohmann::json::array({rows[i]}).dump(), {}, 1);
+      if (!ok)
+        rejected.fetch_add(1, std::memory_order_relaxed);
+      if (batch_creates[i].done)
+        batch_creates[i].done(ok);
+    }
+    if (!ids.empty()) {
+      int ok = !single && write_sessions("[]", ids, 1);
+      if (!ok)
+        rejected.fetch_add(ids.size(), std::memory_order_relaxed);
+      for (auto& done : batch_waiters)
+        done(ok);
+    }
+  }
+
+  /**
+   * Write the queued sessions as soon as there are any, until the writer is destroyed and the
+   * queue is empty. Writes queued while a batch is being written go out together in the next one,
+   * so an idle writer adds no latency and a busy one batches by itself. A non-zero interval holds
+   * each batch open a little longer, until it fills up to max_batch.
+   */
+  void SessionWriter::run_writer() {
+    std::unique_lock<std::mutex> lock(writer_mutex);
+    while (true) {
+      writer_cv.wait(lock, [this] { return stopping || !creates.empty() || !invalidations.empty(); });
+      if (creates.empty() && invalidations.empty())
+        return;
+      if (interval.count() > 0) {
+        writer_cv.wait_for(lock, interval, [this] {
+          return stopping || creates.size() + invalidations.size() >= max_batch;
+        });
+      }
+
+      std::vector<PendingCreate> batch_creates;
+      std::unordered_set<std::string> batch_invalidations;
+      std::vector<std::function<void(int)>> batch_waiters;
+      batch_creates.swap(creates);
+      batch_invalidations.swap(invalidations);
+      batch_waiters.swap(invalidation_waiters);
+      lock.unlock();
+
+      write_batch(batch_creates, batch_invalidations, batch_waiters);
+      lock.lock();
+    }
+  }
+
+  /**
+   * Get the counters of the session writer.
+   * @return Snapshot of the counters.
+   */
+  SessionWriterStats SessionWriter::get_stats() {
+    std::lock_guard<std::mutex> lock(writer_mutex);
+    return {created.load(), invalidated.load(), coalesced.load(), flushes.load(), failed.load(), rejected.load(),
+      creates.size() + invalidations.size()};
+  }
+
+  /**
+   * Initialize the global session writer.
+   * @param interval How long to keep collecting writes once one is queued, 0 to write it straight away.
+   * @param max_batch Number of queued writes that gets written without waiting for the interval.
+   */
+  void init_session_writer(std::chrono::milliseconds interval, size_t max_batch) {
+    if (!global_session_writer) {
+      global_session_writer = new SessionWriter(interval, max_batch);
+    }
+  }
+
+  /**
+   * Get the global session writer.
+   * @return Global session writer.
+   */
+  SessionWriter& get_session_writer() {
+    if (!global_session_writer) {
+      throw std::runtime_error("Session writer not initialized. Call init_session_writer first.");
+    }
+    return *global_session_writer;
+  }
+
+  /**
+   * Write the sessions still queued and stop the global session writer, on shutdown.
+   */
+  void stop_session_writer() {
+    delete global_session_writer;
+    global_session_writer = nullptr;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,96 @@
+#ifndef SESSION_WRITER_HPP
+#define SESSION_WRITER_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+namespace request {
+  /**
+   * Session to insert into "Sessions".
+   */
+  struct SessionRecord {
+    std::string session_id;
+    int user_id;
+    std::string username;
+    int duration;            // seconds until the session expires
+    std::string ip_address;
+  };
+
+  struct SessionWriterStats {
+    uint64_t created;        // sessions inserted
+    uint64_t invalidated;    // sessions marked inactive
+    uint64_t coalesced;      // invalidations of a session ID that was already queued
+    uint64_t flushes;        // batches committed
+    uint64_t failed;         // batches that couldn't be written after retrying
+    uint64_t rejected;       // writes that still failed once their batch was written row by row
+    size_t pending;
+  };
+
+  /**
+   * Write-behind queue for session writes. A background thread writes the queued inserts and
+   * invalidations together in one statement, a multi-row INSERT and an UPDATE ... WHERE id = ANY($2),
+   * and everything queued while it does so goes out in the next statement. A burst of logins or
+   * expired cookies therefore costs one round trip per batch instead of one transaction per request.
+   * Callers that need the write to be durable pass a callback, which is called with 1 once the
+   * batch has committed or 0 if it couldn't be written. A batch that keeps failing is written row by
+   * row, so one row the database turns down only fails its own caller. Whatever is still queued is
+   * written before the writer is destroyed, and writes queued after that are failed straight away.
+   */
+  class SessionWriter {
+  private:
+    struct PendingCreate {
+      SessionRecord record;
+      std::function<void(int)> done;
+    };
+
+    std::mutex writer_mutex;
+    std::condition_variable writer_cv;
+    std::vector<PendingCreate> creates;
+    std::unordered_set<std::string> invalidations;
+    std::vector<std::function<void(int)>> invalidation_waiters;
+    std::chrono::milliseconds interval;
+    size_t max_batch;
+    bool stopping;
+    std::atomic<uint64_t> created;
+    std::atomic<uint64_t> invalidated;
+    std::atomic<uint64_t> coalesced;
+    std::atomic<uint64_t> flushes;
+    std::atomic<uint64_t> failed;
+    std::atomic<uint64_t> rejected;
+    std::thread writer;
+
+    int write_sessions(const std::string& rows_json, const std::vector<std::string>& ids, int attempts);
+    void write_batch(std::vector<PendingCreate>& batch_creates, const std::unordered_set<std::string>& batch_invalidations,
+      std::vector<std::function<void(int)>>& batch_waiters);
+    void run_writer();
+  public:
+    SessionWriter(std::chrono::milliseconds interval, size_t max_batch);
+    ~SessionWriter();
+
+    SessionWriter(const SessionWriter&) = delete;
+    SessionWriter& operator=(const SessionWriter&) = delete;
+
+    void create(SessionRecord record, std::function<void(int)> done);
+    void invalidate(std::string session_id, std::function<void(int)> done);
+    SessionWriterStats get_stats();
+  };
+
+  extern std::chrono::milliseconds SESSION_WRITE_INTERVAL;
+  extern size_t MAX_SESSION_WRITE_BATCH;
+  extern int SESSION_WRITE_ATTEMPTS;
+
+  void init_session_writer(std::chrono::milliseconds interval, size_t max_batch);
+  SessionWriter& get_session_writer();
+  void stop_session_writer();
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+#include "router.hpp"
+
+namespace server {
+  /**
+   * Build a bitmask of HTTP methods, with an empty list allowing every method.
+   * @param methods Methods to include in the mask.
+   * @return Bitmask with one bit per http::verb.
+   */
+  uint64_t method_mask(const std::vector<http::verb>& methods) {
+    if (methods.empty())
+      return ~uint64_t(0);
+
+    uint64_t mask = 0;
+    for (http::verb method : methods) {
+      mask |= uint64_t(1) << static_cast<unsigned>(method);
+    }
+    return mask;
+  }
+
+  /**
+   * Strip the query string from a request target.
+   * @param target Request target to get the path of.
+   * @return Path of the target.
+   */
+  std::string_view get_path(std::string_view target) {
+    return target.substr(0, target.find('?'));
+  }
+
+  /**
+   * Build the route table from the loaded handlers, asking each handler for its
+   * endpoint and methods once.
+   * @param loaded_handlers Handlers to route to, owned by the router.
+   */
+  Router::Router(std::vector<std::unique_ptr<AsyncRequestHandler>> loaded_handlers)
+    : handlers(std::move(loaded_handlers)) {
+    for (const auto& handler : handlers) {
+      std::string endpoint = handler->get_endpoint();
+      std::vector<http::verb> methods = handler->get_methods();
+
+      auto route = std::make_unique<Route>();
+      route->handler = handler.get();
+      route->methods = method_mask(methods);
+      route->cacheable = handler->is_cacheable();
+      for (http::verb method : methods) {
+        if (!route->allow.empty())
+          route->allow += ", ";
+        route->allow += http::to_string(method).to_string();
+      }
+
+      if (!exact.emplace(endpoint, route.get()).second)
+        throw std::runtime_error("Duplicate handler for endpoint: " + endpoint);
+      insert_prefix(endpoint, route.get());
+      routes.push_back(std::move(route));
+    }
+  }
+
+  /**
+   * Insert an endpoint into the prefix trie, splitting edges where labels diverge.
+   * @param endpoint Endpoint to insert.
+   * @param route Route to store at the endpoint.
+   */
+  void Router::insert_prefix(const std::string& endpoint, const Route* route) {
+    Node* node = &root;
+    std::string_view rest = endpoint;
+
+    while (!rest.empty()) {
+      Node* next = nullptr;
+      for (auto& child : node->children) {
+        if (child->label[0] == rest[0]) {
+          next = child.get();
+          break;
+        }
+      }
+
+      if (!next) {
+        auto leaf = std::make_unique<Node>();
+        leaf->label = std::string(rest);
+        leaf->route = route;
+        node->children.push_back(std::move(leaf));
+        return;
+      }
+
+      size_t common = 0;
+      while (common < next->label.size() && common < rest.size() && next->label[common] == rest[common]) {
+        common++;
+      }
+
+      // split the edge so the shared part becomes its own node
+      if (common < next->label.size()) {
+        auto tail = std::make_unique<Node>();
+        tail->label = next->label.substr(common);
+        tail->children = std::move(next->children);
+        tail->route = next->route;
+
+        next->label.resize(common);
+        next->children.clear();
+        next->children.push_back(std::move(tail));
+        next->route = nullptr;
+      }
+
+      node = next;
+      rest.remove_prefix(common);
+    }
+    node->route = route;
+  }
+
+  /**
+   * Find the longest endpoint that is a prefix of the path on a '/' boundary.
+   * @param path Path to match.
+   * @return Matching route, nullptr if there is none.
+   */
+  const Route* Router::match_prefix(std::string_view path) const {
+    const Node* node = &root;
+    const Route* best = nullptr;
+    size_t consumed = 0;
+
+    while (consumed < path.size()) {
+      const Node* next = nullptr;
+      for (const auto& child : node->children) {
+        if (child->label[0] == path[consumed]) {
+          next = child.get();
+          break;
+        }
+      }
+      if (!next || path.compare(consumed, next->label.size(), next->label) != 0)
+        break;
+
+      consumed += next->label.size();
+      node = next;
+      if (node->route && (consumed == path.size() || path[consumed] == '/' || path[consumed - 1] == '/'))
+        best = node->route;
+    }
+    return best;
+  }
+
+  /**
+   * Find the route for a request.
+   * @param target Request target, the query string is ignored.
+   * @param method Method of the request.
+   * @return Matching route (nullptr if none) and whether it accepts the method.
+   */
+  RouteMatch Router::match(std::string_view target, http::verb method) const {
+    std::string_view path = get_path(target);
+
+    const Route* route = nullptr;
+    auto it = exact.find(path);
+    if (it != exact.end()) {
+      route = it->second;
+    } else {
+      route = match_prefix(path);
+    }
+
+    if (!route)
+      return {nullptr, 0};
+    return {route, (route->methods >> static_cast<unsigned>(method)) & 1 ? 1 : 0};
+  }
+
+  /**
+   * Get the number of routes in the table.
+   * @return Number of routes.
+   */
+  size_t Router::size() const {
+    return routes.size();
+  }
+}
\ No newline at end of file
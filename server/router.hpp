@@ -0,0 +1,75 @@
+#ifndef ROUTER_HPP
+#define ROUTER_HPP
+
+#include <boost/beast/http.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "request/async_request_handler.hpp"
+
+namespace http = boost::beast::http;
+
+namespace server {
+  struct Route {
+    AsyncRequestHandler* handler;
+    uint64_t methods;
+    std::string allow;
+    int cacheable;
+  };
+
+  struct RouteMatch {
+    const Route* route;
+    int method_allowed;
+  };
+
+  /**
+   * Transparent hash so routes can be looked up by a view into the request target.
+   */
+  struct PathHash {
+    using is_transparent = void;
+    size_t operator()(std::string_view path) const {
+      return std::hash<std::string_view>{}(path);
+    }
+  };
+
+  /**
+   * Route table built once from the loaded handlers. Exact endpoints are looked up in a
+   * hash map, anything below an endpoint ("/api/category/..." for "/api/category") is
+   * found by the longest matching prefix in a radix trie. Prefixes only match on a '/'
+   * boundary, so "/api/users" never falls through to "/api/user".
+   */
+  class Router {
+  private:
+    struct Node {
+      std::string label;
+      std::vector<std::unique_ptr<Node>> children;
+      const Route* route = nullptr;
+    };
+
+    std::vector<std::unique_ptr<AsyncRequestHandler>> handlers;
+    std::vector<std::unique_ptr<Route>> routes;
+    std::unordered_map<std::string, const Route*, PathHash, std::equal_to<>> exact;
+    Node root;
+
+    void insert_prefix(const std::string& endpoint, const Route* route);
+    const Route* match_prefix(std::string_view path) const;
+  public:
+    explicit Router(std::vector<std::unique_ptr<AsyncRequestHandler>> handlers);
+
+    Router(const Router&) = delete;
+    Router& operator=(const Router&) = delete;
+
+    RouteMatch match(std::string_view target, http::verb method) const;
+    size_t size() const;
+  };
+
+  uint64_t method_mask(const std::vector<http::verb>& methods);
+  std::string_view get_path(std::string_view target);
+}
+
+#endif
\ No newline at end of file
@@ -1,16 +1,46 @@
 #include "server.hpp"
 
 namespace server {
+  static Router* global_router = nullptr;
+
+  SyncRequestHandler::SyncRequestHandler(RequestHandler* handler) : handler_(handler) {}
+
+  std::string SyncRequestHandler::get_endpoint() const {
+    return handler_->get_endpoint();
+  }
+
+  std::vector<http::verb> SyncRequestHandler::get_methods() const {
+    return handler_->get_methods();
+  }
+
+  int SyncRequestHandler::is_cacheable() const {
+    return handler_->is_cacheable();
+  }
+
+  /**
+   * Run the wrapped handler on the worker pool.
+   * @param req HTTP request to handle.
+   * @param ip_address IP address of the client.
+   * @return HTTP response.
+   */
+  net::awaitable<http::response<http::string_body>> SyncRequestHandler::handle_request(
+    const http::request<http::string_body>& req, const std::string& ip_address) {
+    co_return co_await get_worker_pool().run([this, &req, &ip_address]() {
+      return handler_->handle_request(req, ip_address);
+    });
+  }
+
   /**
     * Load all request handlers from the specified directory.
     * This function loads all shared objects (.so files) from the specified directory and
-    * looks for a function named create_<handler_name>_handler in each of them.
+    * looks for a function named create_<handler_name>_async_handler in each of them, falling
+    * back to create_<handler_name>_handler for synchronous handlers.
     *
     * @param directory Directory to load handlers from.
     * @return Vector of unique pointers to the loaded request handlers.
     */
-  std::vector<std::unique_ptr<RequestHandler>> load_handlers(const std::string& directory) {
-    std::vector<std::unique_ptr<RequestHandler>> handlers;
+  std::vector<std::unique_ptr<AsyncRequestHandler>> load_handlers(const std::string& directory) {
+    std::vector<std::unique_ptr<AsyncRequestHandler>> handlers;
 
     for (const auto& entry : std::filesystem::directory_iterator(directory)) {
       if (entry.path().extension() == ".so") {
@@ -22,13 +52,22 @@ namespace server {
         std::string filename = entry.path().stem().string();
         if (filename.rfind("lib", 0) == 0)
           filename = filename.substr(3);
+
+        std::string async_function_name = "create_" + filename + "_async_handler";
+        auto create_async_handler = reinterpret_cast<AsyncRequestHandler* (*)()>(dlsym(lib_handle, async_function_name.c_str()));
+        if (create_async_handler) {
+          handlers.emplace_back(create_async_handler());
+          continue;
+        }
+
         std::string function_name = "create_" + filename + "_handler";
         auto create_handler = reinterpret_cast<RequestHandler* (*)()>(dlsym(lib_handle, function_name.c_str()));
         if (!create_handler) {
           dlclose(lib_handle);
-          throw std::runtime_error("Failed to find " + function_name + " function in: " + entry.path().string());
+          throw std::runtime_error("Failed to find " + async_function_name + " or " + function_name +
+            " function in: " + entry.path().string());
         }
-        handlers.emplace_back(create_handler());
+        handlers.emplace_back(std::make_unique<SyncRequestHandler>(create_handler()));
       }
     }
 
@@ -36,14 +75,34 @@ namespace server {
   }
 
   /**
-    * Handle an HTTP request. This function iterates over all loaded request handlers and
-    * calls their handle_request method if the request target starts with the handler's endpoint.
+   * Load the handlers and build the global route table.
+   * @param directory Directory to load handlers from.
+   */
+  void init_router(const std::string& directory) {
+    if (!global_router) {
+      global_router = new Router(load_handlers(directory));
+    }
+  }
+
+  /**
+   * Get the global route table.
+   * @return Global route table.
+   */
+  Router& get_router() {
+    if (!global_router) {
+      throw std::runtime_error("Router not initialized. Call init_router first.");
+    }
+    return *global_router;
+  }
+
+  /**
+    * Handle an HTTP request. This looks up the handler for the request path in the
+    * route table and calls its handle_request method if it accepts the request method.
     *
     * @param req HTTP request to handle.
     * @return HTTP response.
     */
-  http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) {
-    static auto handlers = load_handlers(".");
+  net::awaitable<http::response<http::string_body>> handle_request(http::request<http::string_body> const& req, const std::string& ip_address) {
     http::response<http::string_body> res;
 
     // handle CORS preflight request
@@ -53,19 +112,37 @@ namespace server {
         res.set(http::field::access_control_allow_methods, "GET, POST, PUT, DELETE, OPTIONS");
         res.set(http::field::access_control_allow_headers, "Content-Type, Authorization, Access-Control-Allow-Origin");
         res.set(http::field::access_control_allow_credentials, "true");
-        return res;
+        res.keep_alive(req.keep_alive());
+        co_return res;
     }
 
-    for (const auto& handler : handlers) {
-        if (req.target().starts_with(handler->get_endpoint())) {
-            res = handler->handle_request(req, ip_address);
-            break;
-        }
-    }
-
-    if (res.result() == http::status::unknown) {
+    RouteMatch match = get_router().match(std::string_view(req.target().data(), req.target().size()), req.method());
+    if (!match.route) {
         std::cerr << "No handler found for endpoint: " << req.target() << std::endl;
         res = {http::status::not_found, req.version()};
+        res.prepare_payload();
+    } else if (!match.method_allowed) {
+        res = {http::status::method_not_allowed, req.version()};
+        res.set(http::field::allow, match.route->allow);
+        res.prepare_payload();
+    } else {
+        // cacheable handlers answer conditional GETs from the stored validator themselves, once
+        // the request is rate limited and authorized, a 200 they build anyway becomes a 304 here
+        int conditional = req.method() == http::verb::get && match.route->cacheable;
+        uint64_t generation = get_validator_generation();
+        res = co_await match.route->handler->handle_request(req, ip_address);
+        std::optional<http::response<http::string_body>> not_modified;
+        if (conditional) {
+          store_validator(req, res, generation);
+          not_modified = check_not_modified(req, res);
+        }
+
+        if (not_modified) {
+          res = std::move(*not_modified);
+        } else {
+          auto accept_encoding = req[http::field::accept_encoding];
+          request::compress_response(res, request::negotiate_encoding(std::string_view(accept_encoding.data(), accept_encoding.size())));
+        }
     }
 
     // set CORS headers
@@ -73,28 +150,79 @@ namespace server {
     res.set(http::field::access_control_allow_methods, "GET, POST, PUT, DELETE, OPTIONS");
     res.set(http::field::access_control_allow_headers, "Content-Type, Authorization");
     res.set(http::field::access_control_allow_credentials, "true");
-    
-    return res;
+
+    // handlers may build responses without looking at the request's connection header
+    res.keep_alive(req.keep_alive());
+    co_return res;
   }
 
-  Session::Session(tcp::socket socket) : socket_(std::move(socket)) {}
+  /* keep-alive limits */
+  std::chrono::seconds READ_TIMEOUT(30);
+  std::chrono::seconds IDLE_TIMEOUT(60);
+  int MAX_REQUESTS_PER_CONNECTION = 1000;
+
+  Session::Session(tcp::socket socket) : stream_(std::move(socket)), requests_handled_(0) {}
   void Session::run() {
+    // the peer may already be gone, so don't let remote_endpoint throw on the I/O thread
+    beast::error_code ec;
+    auto endpoint = stream_.socket().remote_endpoint(ec);
+    if (ec)
+      return;
+    ip_address_ = endpoint.address().to_string();
     do_read();
   }
 
   /**
-   * Read a request from the client.
+   * Read the next request from the client.
+   * The first request on a connection gets READ_TIMEOUT to arrive, after that the
+   * connection may sit idle between requests for up to IDLE_TIMEOUT.
    */
   void Session::do_read() {
-    auto self(shared_from_this());
-    http::async_read(socket_, buffer_, req_, [this, self](beast::error_code ec, std::size_t) {
-      if (!ec) {
-        boost::asio::ip::address ip_address = socket_.remote_endpoint().address();
-        std::string ip_str = ip_address.to_string();
-        auto res = handle_request(req_, ip_str);
-        do_write(std::move(res));
-      }
-    });
+    // the parser requires a fresh message for every read
+    req_ = {};
+    stream_.expires_after(requests_handled_ == 0 ? READ_TIMEOUT : IDLE_TIMEOUT);
+
+    http::async_read(stream_, buffer_, req_, beast::bind_front_handler(
+      [](std::shared_ptr<Session> self, beast::error_code ec, std::size_t) {
+        self->on_read(ec);
+      }, shared_from_this()));
+  }
+
+  /**
+   * Handle a request once it has been read. Pipelined requests are left in the
+   * buffer by async_read and are picked up in order by the next do_read.
+   *
+   * The request is handled by a coroutine on the session's strand. Synchronous handlers
+   * block on the database and bcrypt, so they are run on the worker pool and resume
+   * here once finished.
+   * @param ec Error from the read, if any.
+   */
+  void Session::on_read(beast::error_code ec) {
+    if (ec == http::error::end_of_stream)
+      return do_close();
+    if (ec)
+      return;
+
+    requests_handled_++;
+    net::co_spawn(stream_.get_executor(), handle_request(req_, ip_address_),
+      [self = shared_from_this()](std::exception_ptr error, http::response<http::string_body> res) {
+        if (error) {
+          try {
+            std::rethrow_exception(error);
+          } catch (const QueueFullError&) {
+            res = request::make_service_unavailable_response("Server is busy", self->req_);
+          } catch (const postgres::PoolTimeoutError&) {
+            res = request::make_service_unavailable_response("Database is busy", self->req_);
+          } catch (const std::exception& e) {
+            std::cerr << "Error handling request: " << e.what() << std::endl;
+            res = request::make_internal_server_error_response("Internal server error", self->req_);
+          } catch (...) {
+            std::cerr << "Unknown error handling request" << std::endl;
+            res = request::make_internal_server_error_response("Internal server error", self->req_);
+          }
+        }
+        self->do_write(std::move(res));
+      });
   }
 
   /**
@@ -102,11 +230,38 @@ namespace server {
    * @param res Response to write.
    */
   void Session::do_write(http::response<http::string_body> res) {
-    auto self(shared_from_this());
+    if (requests_handled_ >= MAX_REQUESTS_PER_CONNECTION)
+      res.keep_alive(false);
     auto sp = std::make_shared<http::response<http::string_body>>(std::move(res));
-    http::async_write(socket_, *sp, [this, self, sp](beast::error_code ec, std::size_t) {
-      socket_.shutdown(tcp::socket::shutdown_send, ec);
-    });
+    bool keep_alive = sp->keep_alive();
+
+    stream_.expires_after(READ_TIMEOUT);
+    http::async_write(stream_, *sp, beast::bind_front_handler(
+      [keep_alive, sp](std::shared_ptr<Session> self, beast::error_code ec, std::size_t) {
+        self->on_write(keep_alive, ec);
+      }, shared_from_this()));
+  }
+
+  /**
+   * Continue with the next request on the connection, or close it if the
+   * response asked for the connection to be closed.
+   * @param keep_alive Whether the connection should stay open.
+   * @param ec Error from the write, if any.
+   */
+  void Session::on_write(bool keep_alive, beast::error_code ec) {
+    if (ec)
+      return;
+    if (!keep_alive)
+      return do_close();
+    do_read();
+  }
+
+  /**
+   * Gracefully close the connection.
+   */
+  void Session::do_close() {
+    beast::error_code ec;
+    stream_.socket().shutdown(tcp::socket::shutdown_send, ec);
   }
 
   Listener::Listener(net::io_context& ioc, tcp::endpoint endpoint)
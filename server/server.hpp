@@ -1,10 +1,12 @@
 #ifndef SERVER_HPP
 #define SERVER_HPP
 
+#include <utility>
 #include <boost/beast/core.hpp>
 #include <boost/beast/http.hpp>
 #include <boost/asio/ip/tcp.hpp>
 #include <boost/asio/strand.hpp>
+#include <boost/asio/co_spawn.hpp>
 #include <boost/config.hpp>
 
 #include <filesystem>
@@ -16,10 +18,17 @@
 #include <string>
 #include <thread>
 #include <map>
+#include <chrono>
 
 #include "parser/parser.hpp"
 #include "request/request_handler.hpp"
+#include "request/async_request_handler.hpp"
 #include "request/postgres.hpp"
+#include "request/request.hpp"
+#include "request/compression.hpp"
+#include "worker_pool.hpp"
+#include "router.hpp"
+#include "conditional.hpp"
 
 namespace beast = boost::beast;
 namespace http = beast::http;
@@ -27,13 +36,37 @@ namespace net = boost::asio;
 using tcp = net::ip::tcp;
 
 namespace server {
-  std::vector<std::unique_ptr<RequestHandler>> load_handlers(const std::string& directory);
-  http::response<http::string_body> handle_request(http::request<http::string_body> const& req, const std::string& ip_address);
+  /**
+   * Adapter that runs a synchronous handler on the worker pool, so both kinds of
+   * handler can be awaited the same way.
+   */
+  class SyncRequestHandler : public AsyncRequestHandler {
+    std::unique_ptr<RequestHandler> handler_;
+
+  public:
+    explicit SyncRequestHandler(RequestHandler* handler);
+    std::string get_endpoint() const override;
+    std::vector<http::verb> get_methods() const override;
+    int is_cacheable() const override;
+    net::awaitable<http::response<http::string_body>> handle_request(const http::request<http::string_body>& req, const std::string& ip_address) override;
+  };
+
+  std::vector<std::unique_ptr<AsyncRequestHandler>> load_handlers(const std::string& directory);
+  void init_router(const std::string& directory);
+  Router& get_router();
+  net::awaitable<http::response<http::string_body>> handle_request(http::request<http::string_body> const& req, const std::string& ip_address);
+
+  // keep-alive limits
+  extern std::chrono::seconds READ_TIMEOUT;
+  extern std::chrono::seconds IDLE_TIMEOUT;
+  extern int MAX_REQUESTS_PER_CONNECTION;
 
   class Session : public std::enable_shared_from_this<Session> {
-    tcp::socket socket_;
+    beast::tcp_stream stream_;
     beast::flat_buffer buffer_;
     http::request<http::string_body> req_;
+    std::string ip_address_;
+    int requests_handled_;
 
   public:
     explicit Session(tcp::socket socket);
@@ -41,7 +74,10 @@ namespace server {
 
   private:
     void do_read();
+    void on_read(beast::error_code ec);
     void do_write(http::response<http::string_body> res);
+    void on_write(bool keep_alive, beast::error_code ec);
+    void do_close();
   };
 
   class Listener : public std::enable_shared_from_this<Listener> {
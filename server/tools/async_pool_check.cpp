@@ -0,0 +1,293 @@
+#include "../request/async_postgres.hpp"
+#include "../request/postgres.hpp"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+/**
+ * Read exactly n bytes from a socket.
+ * @param fd Socket to read.
+ * @param buffer Where to store the bytes.
+ * @param n Number of bytes.
+ * @return 1 if they were read, 0 if the peer closed the connection first.
+ */
+static int read_exact(int fd, char * buffer, size_t n) {
+  while (n > 0) {
+    ssize_t r = read(fd, buffer, n);
+    if (r <= 0)
+      return 0;
+    buffer += r;
+    n -= r;
+  }
+  return 1;
+}
+
+/**
+ * Write all of a buffer to a socket, giving up if the peer is gone.
+ * @param fd Socket to write.
+ * @param data Bytes to write.
+ */
+static void send_all(int fd, const std::string& data) {
+  size_t sent = 0;
+  while (sent < data.size()) {
+    ssize_t w = write(fd, data.data() + sent, data.size() - sent);
+    if (w <= 0)
+      return;
+    sent += w;
+  }
+}
+
+/**
+ * Encode integers in network order, as the protocol sends them.
+ */
+static std::string int32(uint32_t value) {
+  value = htonl(value);
+  return std::string(reinterpret_cast<const char *>(&value), 4);
+}
+
+static std::string int16(uint16_t value) {
+  value = htons(value);
+  return std::string(reinterpret_cast<const char *>(&value), 2);
+}
+
+/**
+ * Frame a backend message of the v3 protocol.
+ * @param type Message type.
+ * @param body Message body.
+ * @return Message with its type and length.
+ */
+static std::string message(char type, const std::string& body = "") {
+  return type + int32(body.size() + 4) + body;
+}
+
+/**
+ * Read the startup message of a connection and accept it without authentication.
+ * @param fd Accepted connection.
+ * @return 1 if the client can send queries, 0 if it went away.
+ */
+static int start_up(int fd) {
+  char header[4];
+  std::string body;
+  // the client may ask for SSL or GSS encryption before the startup message
+  for (;;) {
+    if (!read_exact(fd, header, 4))
+      return 0;
+    body.resize(ntohl(*reinterpret_cast<uint32_t*>(header)) - 4);
+    if (!read_exact(fd, body.data(), body.size()))
+      return 0;
+    uint32_t code = ntohl(*reinterpret_cast<const uint32_t*>(body.data()));
+    if (code != 80877103 && code != 80877104)
+      break;
+    send_all(fd, "N");
+  }
+
+  std::string out = message('R', int32(0));
+  out += message('S', std::string("server_version\0" "16.0\0", 20));
+  out += message('S', std::string("client_encoding\0" "UTF8\0", 21));
+  out += message('S', std::string("standard_conforming_strings\0" "on\0", 31));
+  out += message('Z', "I");
+  send_all(fd, out);
+  return 1;
+}
+
+/**
+ * Answer one libpq connection with just enough of the v3 protocol for the pool: every
+ * statement prepares, and executing one returns its first parameter as a single row. A
+ * statement whose first parameter is "hang" gets no answer, like a server that stopped
+ * responding, and nothing else on that connection is answered either.
+ * @param fd Accepted connection, closed when the client goes away.
+ */
+static void serve_connection(int fd) {
+  if (!start_up(fd)) {
+    close(fd);
+    return;
+  }
+
+  char header[5];
+  std::string body;
+  std::string pending;
+  std::string param;
+  int hung = 0;
+  while (read_exact(fd, header, 5)) {
+    uint32_t length = ntohl(*reinterpret_cast<uint32_t*>(header + 1));
+    body.resize(length - 4);
+    if (!read_exact(fd, body.data(), body.size()) || header[0] == 'X')
+      break;
+    if (hung)
+      continue;
+
+    if (header[0] == 'P') {
+      pending += message('1');
+    } else if (header[0] == 'B') {
+      // portal and statement names, parameter formats, then the parameters
+      size_t at = body.find('\0') + 1;
+      at = body.find('\0', at) + 1;
+      at += 2 + 2 * ntohs(*reinterpret_cast<const uint16_t*>(body.data() + at));
+      param.clear();
+      if (ntohs(*reinterpret_cast<const uint16_t*>(body.data() + at)) > 0) {
+        int32_t size = ntohl(*reinterpret_cast<const uint32_t*>(body.data() + at + 2));
+        if (size > 0)
+          param.assign(body.data() + at + 6, size);
+      }
+      pending += message('2');
+    } else if (header[0] == 'E') {
+      if (param == "hang") {
+        hung = 1;
+        continue;
+      }
+      pending += message('T', int16(1) + std::string("value\0", 6) + int32(0) + int16(0) + int32(25) + int16(-1) + int32(-1) + int16(0));
+      pending += message('D', int16(1) + int32(param.size()) + param);
+      pending += message('C', std::string("SELECT 1\0", 9));
+    } else if (header[0] == 'S' || header[0] == 'H') {
+      if (header[0] == 'S')
+        pending += message('Z', "I");
+      send_all(fd, pending);
+      pending.clear();
+    }
+  }
+  close(fd);
+}
+
+/**
+ * Start the fake server on a loopback port, serving each connection on its own thread.
+ * @return Port it listens on, 0 if it couldn't be started.
+ */
+static unsigned short start_fake_server() {
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address{};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t size = sizeof(address);
+  if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&address), size) != 0 || listen(fd, 16) != 0 ||
+      getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size) != 0)
+    return 0;
+
+  std::thread([fd] {
+    for (;;) {
+      int client = accept(fd, nullptr, nullptr);
+      if (client >= 0)
+        std::thread(serve_connection, client).detach();
+    }
+  }).detach();
+  return ntohs(address.sin_port);
+}
+
+static int failures = 0;
+
+/**
+ * Report a check, counting it if it failed.
+ * @param condition Whether the check passed.
+ * @param what What was checked.
+ */
+static void expect(int condition, const std::string& what) {
+  std::cout << (condition ? "ok      " : "FAILED  ") << what << std::endl;
+  if (!condition)
+    failures++;
+}
+
+static double ms_since(clock_type::time_point start) {
+  return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+/**
+ * Run a statement on a pool, recording how it ended.
+ * @param pool Pool to run it on.
+ * @param param Parameter of the statement, "hang" for one the fake server never answers.
+ * @param elapsed Set to how long the call took, in milliseconds.
+ * @return 1 if it returned a row, 0 if it failed, -1 if the pool turned the caller away.
+ */
+static net::awaitable<int> run_query(postgres::AsyncConnectionPool& pool, std::string param, double& elapsed) {
+  auto start = clock_type::now();
+  int outcome;
+  try {
+    postgres::QueryResult result = co_await pool.query("select_user_data_from_session", std::vector<std::string>(1, param));
+    outcome = result.ok() && result.rows() == 1;
+  } catch (const postgres::PoolTimeoutError&) {
+    outcome = -1;
+  }
+  elapsed = ms_since(start);
+  co_return outcome;
+}
+
+/**
+ * Check the asynchronous pool's deadlines against a fake server that stops answering: a
+ * query that outlives ASYNC_QUERY_TIMEOUT fails and its connection is reopened for the next
+ * caller, callers past the waiter limit are turned away at once, and a waiter that doesn't
+ * get a connection in time gives up. Needs no database.
+ * Usage: trivia-async-pool-check
+ */
+int main() {
+  unsigned short port = start_fake_server();
+  if (!port) {
+    std::cerr << "Failed to start the fake server" << std::endl;
+    return 1;
+  }
+  std::string conninfo = "host=127.0.0.1 port=" + std::to_string(port) + " user=trivia dbname=trivia sslmode=disable gssencmode=disable";
+  postgres::ASYNC_QUERY_TIMEOUT = std::chrono::milliseconds(300);
+  postgres::ASYNC_CONNECT_TIMEOUT = std::chrono::milliseconds(1000);
+
+  net::io_context ioc;
+  postgres::AsyncConnectionPool reconnecting(ioc, conninfo, 1, 1, 2, std::chrono::milliseconds(2000));
+  postgres::AsyncConnectionPool limited(ioc, conninfo, 1, 1, 2, std::chrono::milliseconds(2000));
+  postgres::AsyncConnectionPool impatient(ioc, conninfo, 1, 1, 2, std::chrono::milliseconds(100));
+
+  net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+    double elapsed;
+    int outcome = co_await run_query(reconnecting, "hang", elapsed);
+    expect(outcome == 0 && elapsed >= 300 && elapsed < 1000, "query on a server that stopped answering fails after the query timeout (" +
+      std::to_string((int) elapsed) + " ms)");
+    outcome = co_await run_query(reconnecting, "alice", elapsed);
+    postgres::AsyncPoolStats stats = reconnecting.get_stats();
+    expect(outcome == 1 && stats.reconnects == 1 && stats.query_timeouts == 1, "next query reconnects and succeeds (" +
+      std::to_string(stats.reconnects) + " reconnects, " + std::to_string(stats.query_timeouts) + " query timeouts)");
+  }, net::detached);
+
+  // one caller holds the only connection until its query times out, two wait for it and the rest are turned away
+  std::vector<int> outcomes(5);
+  std::vector<double> elapsed(5);
+  for (size_t i = 0; i < outcomes.size(); i++) {
+    net::co_spawn(ioc, [&, i]() -> net::awaitable<void> {
+      outcomes[i] = co_await run_query(limited, i == 0 ? "hang" : "bob", elapsed[i]);
+    }, net::detached);
+  }
+
+  int waiter_outcome = 0;
+  double waiter_elapsed = 0;
+  net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+    double hang_elapsed;
+    co_await run_query(impatient, "hang", hang_elapsed);
+  }, net::detached);
+  net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+    waiter_outcome = co_await run_query(impatient, "carol", waiter_elapsed);
+  }, net::detached);
+
+  // one thread, so the callers reach the pools in the order they were spawned
+  ioc.run();
+
+  int served = 0, rejected = 0, timed_out = 0;
+  for (size_t i = 0; i < outcomes.size(); i++) {
+    served += outcomes[i] == 1;
+    rejected += outcomes[i] == -1 && elapsed[i] < 50;
+    timed_out += outcomes[i] == 0;
+  }
+  expect(served == 2 && rejected == 2 && timed_out == 1, "with 2 waiters allowed, 2 callers wait and are served and 2 are turned away at once (" +
+    std::to_string(served) + " served, " + std::to_string(rejected) + " turned away)");
+  expect(limited.get_stats().acquire_timeouts == 2, "turned away callers are counted as acquire timeouts");
+  expect(waiter_outcome == -1 && waiter_elapsed >= 100 && waiter_elapsed < 300, "waiter gives up after the acquire timeout (" +
+    std::to_string((int) waiter_elapsed) + " ms)");
+
+  std::cout << (failures ? "FAILED" : "passed") << std::endl;
+  return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -0,0 +1,67 @@
+#include "../parser/parser.hpp"
+#include "../parser/json_writer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+/**
+ * Time a way of building a category response body.
+ * @param build Builds the body.
+ * @param runs Number of runs, the average is reported.
+ * @return Average run in milliseconds.
+ */
+template <typename Build>
+static double time_body(Build build, int runs) {
+  size_t bytes = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < runs; i++)
+    bytes += build().size();
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  // keep the bodies from being optimized away
+  if (bytes == 0)
+    std::cerr << "Empty body" << std::endl;
+  return ms / runs;
+}
+
+/**
+ * Compare the ways a category response body has been built: the nlohmann DOM dumped, parsed
+ * and dumped again inside the envelope, the streaming writer, and a copy of the cached body.
+ * Usage: trivia-category-bench <questions folder> <category> [runs]
+ */
+int main(int argc, char ** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <questions folder> <category> [runs]" << std::endl;
+    return 1;
+  }
+  int runs = argc > 3 ? std::max(1, std::atoi(argv[3])) : 20;
+
+  parser::MappedCategory cat;
+  if (!parser::map_category(argv[1], argv[2], cat)) {
+    std::cerr << "Failed to map category " << argv[2] << std::endl;
+    return 1;
+  }
+
+  std::string streamed;
+  parser::write_category_json(streamed, cat);
+  std::string dumped = parser::fetch_category(cat).dump();
+  std::cout << cat.category << ": " << cat.questions.size() << " questions, " << streamed.size() << " bytes of JSON, "
+    << (streamed == dumped ? "identical to" : "DIFFERENT from") << " fetch_category().dump(), size estimate "
+    << parser::category_json_size(cat) << std::endl;
+
+  double dom = time_body([&] {
+    nlohmann::json message = nlohmann::json::parse(parser::fetch_category(cat).dump());
+    nlohmann::json response = {{"status", "ok"}, {"message", message}};
+    return response.dump();
+  }, runs);
+  double writer = time_body([&] { return parser::write_category_response(cat); }, runs);
+  std::string cached = parser::write_category_response(cat);
+  double copy = time_body([&] { return std::string(cached); }, runs);
+
+  std::cout << "DOM + dump + parse + dump: " << dom << " ms" << std::endl;
+  std::cout << "streaming writer: " << writer << " ms" << std::endl;
+  std::cout << "cached body copy: " << copy << " ms" << std::endl;
+  parser::unmap_category(cat);
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,23 @@
+#include "../parser/compiled_corpus.hpp"
+
+/**
+ * Compile the category files in a folder into the binary corpus the server maps at startup.
+ * Usage: trivia-corpus-compile <questions folder> <output file>
+ */
+int main(int argc, char ** argv) {
+  if (argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " <questions folder> <output file>" << std::endl;
+    return 1;
+  }
+
+  std::string folder_dir = argv[1];
+  if (folder_dir.back() != '/')
+    folder_dir += '/';
+
+  try {
+    return parser::compile_corpus(folder_dir.c_str(), argv[2], 0, 0) ? 0 : 1;
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+/**
+ * Send requests over keep-alive connections from several threads for a fixed time.
+ * @param endpoints Resolved server address.
+ * @param req Request every thread sends.
+ * @param threads Number of threads, each with its own connection.
+ * @param duration How long to send requests for.
+ * @param errors Set to the number of failed requests.
+ * @return Number of responses received.
+ */
+static uint64_t run(const tcp::resolver::results_type& endpoints, const http::request<http::empty_body>& req, int threads,
+  std::chrono::milliseconds duration, uint64_t& errors) {
+  std::atomic<uint64_t> responses = 0;
+  std::atomic<uint64_t> failed = 0;
+  auto deadline = std::chrono::steady_clock::now() + duration;
+
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&] {
+      net::io_context ioc;
+      uint64_t done = 0;
+      while (std::chrono::steady_clock::now() < deadline) {
+        beast::tcp_stream stream(ioc);
+        beast::flat_buffer buffer;
+        beast::error_code ec;
+        stream.connect(endpoints, ec);
+        // the server closes a connection after its request limit, so reconnect and carry on
+        while (!ec && std::chrono::steady_clock::now() < deadline) {
+          http::write(stream, req, ec);
+          if (ec)
+            break;
+          http::response<http::string_body> res;
+          http::read(stream, buffer, res, ec);
+          if (ec)
+            break;
+          done++;
+          if (!res.keep_alive())
+            break;
+        }
+        if (ec && ec != http::error::end_of_stream)
+          failed++;
+        stream.socket().shutdown(tcp::socket::shutdown_both, ec);
+      }
+      responses += done;
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  errors = failed;
+  return responses;
+}
+
+/**
+ * Drive a running server with an endpoint that doesn't touch the database, an OPTIONS
+ * preflight by default or a GET on an unknown path for the 404, at 1 to 16 client threads.
+ * Usage: trivia-load-bench <host> <port> [target] [method] [seconds]
+ */
+int main(int argc, char ** argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <host> <port> [target] [method] [seconds]" << std::endl;
+    return 1;
+  }
+  std::string target = argc > 3 ? argv[3] : "/api/category";
+  http::verb method = argc > 4 ? http::string_to_verb(argv[4]) : http::verb::options;
+  if (method == http::verb::unknown) {
+    std::cerr << "Unknown method " << argv[4] << std::endl;
+    return 1;
+  }
+  std::chrono::milliseconds duration(argc > 5 ? std::max(1, std::atoi(argv[5])) * 1000 : 5000);
+
+  net::io_context ioc;
+  tcp::resolver resolver(ioc);
+  beast::error_code ec;
+  auto endpoints = resolver.resolve(argv[1], argv[2], ec);
+  if (ec) {
+    std::cerr << "Failed to resolve " << argv[1] << ":" << argv[2] << ": " << ec.message() << std::endl;
+    return 1;
+  }
+
+  http::request<http::empty_body> req{method, target, 11};
+  req.set(http::field::host, argv[1]);
+  req.set(http::field::origin, "http://localhost");
+  req.keep_alive(true);
+
+  std::cout << "hardware threads: " << std::thread::hardware_concurrency() << ", " << req.method_string() << " "
+    << target << std::endl;
+  std::cout << "threads    req/s   errors" << std::endl;
+  for (int threads : {1, 2, 4, 8, 16}) {
+    uint64_t errors = 0;
+    uint64_t responses = run(endpoints, req, threads, duration, errors);
+    std::printf("%7d %8.0f %8llu\n", threads, responses * 1000.0 / duration.count(), (unsigned long long) errors);
+  }
+  return 0;
+}
\ No newline at end of file
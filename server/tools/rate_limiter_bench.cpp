@@ -0,0 +1,84 @@
+#include "../request/middleware.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+static constexpr middleware::RateLimit BENCH_LIMIT = middleware::make_rate_limit("/bench", 1e9, 1e9);
+
+/**
+ * Format the i-th client address, as the server formats the peer address.
+ * @param i Client number.
+ * @return Dotted quad IPv4 address.
+ */
+static std::string client_address(uint32_t i) {
+  return std::to_string(10 + (i >> 24)) + "." + std::to_string((i >> 16) & 255) + "." +
+    std::to_string((i >> 8) & 255) + "." + std::to_string(i & 255);
+}
+
+/**
+ * Check requests from a fixed set of clients against a rate limiter from several threads,
+ * building the key from the address string as the server does on every request.
+ * @param shard_c Number of shards, 1 is a single lock over every client.
+ * @param threads Number of threads checking requests.
+ * @param ops Checks per thread.
+ * @return Wall time per check in nanoseconds, across all threads.
+ */
+static double run(size_t shard_c, int threads, int ops) {
+  middleware::RateLimiter limiter(middleware::MAX_RATE_LIMIT_ENTRIES, shard_c, std::chrono::milliseconds(5000));
+  std::vector<std::string> addresses;
+  for (uint32_t i = 0; i < 4096; i++)
+    addresses.push_back(client_address(i * 2654435761u));
+
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      middleware::RateLimitKey key;
+      for (int i = 0; i < ops; i++) {
+        middleware::make_rate_limit_key(addresses[(i * 7 + t * 613) % addresses.size()], BENCH_LIMIT, key);
+        limiter.limited(key, BENCH_LIMIT);
+      }
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ns / ((double) threads * ops);
+}
+
+/**
+ * Send one request from each of many distinct addresses, as a scan or a spoofed flood would,
+ * and report how many clients the rate limiter keeps.
+ * @param clients Number of distinct addresses.
+ */
+static void flood(uint32_t clients) {
+  middleware::RateLimiter limiter(middleware::MAX_RATE_LIMIT_ENTRIES, middleware::RATE_LIMIT_SHARDS, std::chrono::milliseconds(5000));
+  middleware::RateLimitKey key;
+  for (uint32_t i = 0; i < clients; i++) {
+    middleware::make_rate_limit_key(client_address(i), BENCH_LIMIT, key);
+    limiter.limited(key, BENCH_LIMIT);
+  }
+  middleware::RateLimiterStats stats = limiter.get_stats();
+  printf("flood of %u addresses: %zu clients tracked (capacity %zu), %lu evicted\n",
+    clients, stats.entries, stats.capacity, (unsigned long) stats.evicted);
+}
+
+/**
+ * Compare the sharded rate limiter with a single-lock one at 1, 4 and 16 threads, then check
+ * that a flood of new addresses stays within the limiter's capacity.
+ * Usage: trivia-rate-limiter-bench [checks per thread]
+ */
+int main(int argc, char ** argv) {
+  int ops = argc > 1 ? std::max(1, std::atoi(argv[1])) : 200000;
+  printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+  for (int threads : {1, 4, 16}) {
+    double single = run(1, threads, ops);
+    double sharded = run(middleware::RATE_LIMIT_SHARDS, threads, ops);
+    printf("%2d threads: 1 shard %.0f ns/op, %zu shards %.0f ns/op\n", threads, single, middleware::RATE_LIMIT_SHARDS, sharded);
+  }
+  flood(1000000);
+  return 0;
+}
\ No newline at end of file
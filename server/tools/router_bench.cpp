@@ -0,0 +1,102 @@
+#include "../router.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Handler that only declares an endpoint, the benchmark never calls it.
+ */
+class BenchHandler : public AsyncRequestHandler {
+private:
+  std::string endpoint;
+public:
+  explicit BenchHandler(std::string endpoint) : endpoint(std::move(endpoint)) {}
+
+  std::string get_endpoint() const override {
+    return endpoint;
+  }
+
+  std::vector<http::verb> get_methods() const override {
+    return {http::verb::get, http::verb::post};
+  }
+
+  net::awaitable<http::response<http::string_body>> handle_request(const http::request<http::string_body>&, const std::string&) override {
+    co_return http::response<http::string_body>{};
+  }
+};
+
+/**
+ * Time matching a set of request targets.
+ * @param match Matches one target, returning nonzero if it found a route.
+ * @param targets Targets to match, cycled through.
+ * @param lookups Number of lookups.
+ * @return Average lookup in nanoseconds.
+ */
+template <typename Match>
+static double time_match(Match match, const std::vector<std::string>& targets, size_t lookups) {
+  size_t found = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < lookups; i++)
+    found += match(targets[i % targets.size()]);
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  // keep the lookups from being optimized away
+  if (found == lookups + 1)
+    std::cerr << "Unexpected match count" << std::endl;
+  return ns / lookups;
+}
+
+/**
+ * Time the router on exact paths, paths below an endpoint, unknown paths and methods an
+ * endpoint doesn't accept, for growing numbers of handlers. The scan over every handler
+ * that dispatch used before the router is timed on unknown paths for comparison, since its
+ * first prefix match also let "/api/endpoint1" take "/api/endpoint10" and stop early.
+ * Usage: trivia-router-bench [lookups]
+ */
+int main(int argc, char ** argv) {
+  size_t lookups = argc > 1 ? std::max(1L, std::atol(argv[1])) : 2000000;
+
+  std::cout << "handlers   exact  prefix     404     405  old scan 404 (ns per lookup)" << std::endl;
+  for (size_t count : {4, 16, 64, 256}) {
+    std::vector<std::unique_ptr<AsyncRequestHandler>> handlers;
+    std::vector<std::string> exact, prefix, missing;
+    for (size_t i = 0; i < count; i++) {
+      std::string endpoint = "/api/endpoint" + std::to_string(i);
+      handlers.push_back(std::make_unique<BenchHandler>(endpoint));
+      exact.push_back(endpoint + "?id=" + std::to_string(i));
+      prefix.push_back(endpoint + "/item/" + std::to_string(i));
+      missing.push_back("/api/missing" + std::to_string(i));
+    }
+
+    // the old dispatch asked every handler for its endpoint, in load order
+    std::vector<AsyncRequestHandler*> scan;
+    for (const auto& handler : handlers)
+      scan.push_back(handler.get());
+    server::Router router(std::move(handlers));
+
+    auto match = [&router](http::verb method) {
+      return [&router, method](std::string_view target) {
+        server::RouteMatch m = router.match(target, method);
+        return m.route != nullptr && m.method_allowed;
+      };
+    };
+    double exact_ns = time_match(match(http::verb::get), exact, lookups);
+    double prefix_ns = time_match(match(http::verb::get), prefix, lookups);
+    double missing_ns = time_match(match(http::verb::get), missing, lookups);
+    double disallowed_ns = time_match(match(http::verb::delete_), exact, lookups);
+    double scan_ns = time_match([&scan](std::string_view target) {
+      for (AsyncRequestHandler* handler : scan) {
+        if (target.starts_with(handler->get_endpoint()))
+          return 1;
+      }
+      return 0;
+    }, missing, lookups / 10);
+
+    std::printf("%8zu %7.1f %7.1f %7.1f %7.1f %13.1f\n", count, exact_ns, prefix_ns, missing_ns, disallowed_ns, scan_ns);
+  }
+  return 0;
+}
\ No newline at end of file
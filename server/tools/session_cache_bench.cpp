@@ -0,0 +1,64 @@
+#include "../request/session_cache.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+/**
+ * Run a mix of hits and misses against a session cache from several threads, inserting every
+ * miss as the server does after a database lookup.
+ * @param shard_c Number of shards, 1 is a single lock over the whole cache.
+ * @param threads Number of threads looking up sessions.
+ * @param ops Lookups per thread.
+ * @return Wall time per lookup in nanoseconds, across all threads.
+ */
+static double run(size_t shard_c, int threads, int ops) {
+  const size_t capacity = 1000;
+  const size_t ids = 2000; // about half of the lookups hit
+  request::SessionCache cache(capacity, shard_c);
+
+  std::vector<request::SessionKey> keys(ids);
+  std::mt19937_64 rng(42);
+  for (auto& key : keys) {
+    for (size_t i = 0; i < sizeof(key.bytes); i += 8) {
+      uint64_t r = rng();
+      memcpy(key.bytes + i, &r, 8);
+    }
+  }
+
+  std::vector<std::thread> workers;
+  auto start = std::chrono::steady_clock::now();
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::mt19937 pick(t);
+      request::CachedSession session;
+      for (int i = 0; i < ops; i++) {
+        const request::SessionKey& key = keys[pick() % ids];
+        if (!cache.get(key, session))
+          cache.put(key, {1, "user"}, std::chrono::seconds(3600));
+      }
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+  double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  return ns / ((double) threads * ops);
+}
+
+/**
+ * Compare the sharded session cache with a single-lock one at 1, 4 and 16 threads.
+ * Usage: trivia-session-cache-bench [lookups per thread]
+ */
+int main(int argc, char ** argv) {
+  int ops = argc > 1 ? std::max(1, std::atoi(argv[1])) : 200000;
+  std::cout << "hardware threads: " << std::thread::hardware_concurrency() << std::endl;
+  for (int threads : {1, 4, 16}) {
+    double single = run(1, threads, ops);
+    double sharded = run(16, threads, ops);
+    printf("%2d threads: 1 shard %.0f ns/op, 16 shards %.0f ns/op\n", threads, single, sharded);
+  }
+  return 0;
+}
\ No newline at end of file
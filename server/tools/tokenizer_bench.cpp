@@ -0,0 +1,64 @@
+#include "../parser/tokenizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+/**
+ * Time a tokenizer over some text.
+ * @param text Text to split into records.
+ * @param passes Number of passes, the fastest one is reported.
+ * @return Fastest pass in milliseconds.
+ */
+static double time_tokenizer(const std::string& text, int passes) {
+  std::vector<parser::Record> records;
+  records.reserve(text.size() / 8);
+  double best = 1e9;
+  for (int i = 0; i < passes; i++) {
+    records.clear();
+    auto start = std::chrono::steady_clock::now();
+    parser::tokenize(text, records);
+    best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+  }
+  return best;
+}
+
+/**
+ * Compare the tokenizers on the category files in a folder, and on the same amount of text
+ * made of very short lines.
+ * Usage: trivia-tokenizer-bench <questions folder> [passes]
+ */
+int main(int argc, char ** argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <questions folder> [passes]" << std::endl;
+    return 1;
+  }
+  int passes = argc > 2 ? std::max(1, std::atoi(argv[2])) : 30;
+
+  std::string corpus;
+  for (const auto& entry : std::filesystem::directory_iterator(argv[1])) {
+    std::ifstream file(entry.path(), std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    corpus += contents.str();
+  }
+  std::string short_lines;
+  while (short_lines.size() < corpus.size())
+    short_lines += "#Q Who?\n^ A\nA A\nB B\nC C\nD D\n\n";
+
+  size_t lines = std::count(corpus.begin(), corpus.end(), '\n');
+  std::cout << "corpus: " << corpus.size() << " bytes, " << lines << " lines" << std::endl;
+  for (const char * isa : {"scalar", "sse2", "avx2"}) {
+    if (!parser::select_tokenizer(isa)) {
+      std::cout << isa << ": not supported" << std::endl;
+      continue;
+    }
+    std::cout << isa << ": corpus " << time_tokenizer(corpus, passes) << " ms, short lines "
+      << time_tokenizer(short_lines, passes) << " ms" << std::endl;
+  }
+  return 0;
+}
\ No newline at end of file
@@ -0,0 +1,154 @@
+#include "worker_pool.hpp"
+
+namespace server {
+  static WorkerPool* global_worker_pool = nullptr;
+  // bcrypt runs on its own pool so a burst of logins can't queue ahead of other requests
+  static WorkerPool* global_password_pool = nullptr;
+
+  /**
+   * Create a worker pool.
+   * @param threads Number of threads to run tasks on.
+   * @param capacity Maximum number of tasks waiting to start.
+   */
+  WorkerPool::WorkerPool(size_t threads, size_t capacity)
+    : pool(threads), threads(threads), capacity(capacity), pending(0), submitted(0),
+      rejected(0), completed(0), total_wait_us(0), max_wait_us(0), total_run_us(0), max_run_us(0) {}
+
+  /**
+   * Wait for queued tasks to finish and join the pool threads.
+   */
+  WorkerPool::~WorkerPool() {
+    pool.join();
+  }
+
+  /**
+   * Record how long a task waited in the queue before starting.
+   * @param queued_at Time the task was queued.
+   */
+  void WorkerPool::record_wait(std::chrono::steady_clock::time_point queued_at) {
+    uint64_t wait = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - queued_at).count();
+    total_wait_us += wait;
+
+    uint64_t current_max = max_wait_us.load();
+    while (wait > current_max && !max_wait_us.compare_exchange_weak(current_max, wait)) {}
+  }
+
+  /**
+   * Record how long a task ran once it started.
+   * @param started_at Time the task started.
+   */
+  void WorkerPool::record_run(std::chrono::steady_clock::time_point started_at) {
+    uint64_t run = std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - started_at).count();
+    total_run_us += run;
+
+    uint64_t current_max = max_run_us.load();
+    while (run > current_max && !max_run_us.compare_exchange_weak(current_max, run)) {}
+  }
+
+  /**
+   * Check if the queue has room for another task, so a caller can turn work away before doing
+   * the work of preparing the task. The task is still checked when it is submitted, since the
+   * queue can fill up in between. A full queue counts as a rejected task.
+   * @return 1 if a task would be queued now, 0 if the queue is full.
+   */
+  int WorkerPool::admit() {
+    if (pending.load() < capacity)
+      return 1;
+    rejected++;
+    return 0;
+  }
+
+  /**
+   * Get the executor of the pool, for code that needs to resume on a worker thread.
+   * Work posted directly to the executor bypasses the queue bound.
+   * @return Executor of the pool.
+   */
+  net::thread_pool::executor_type WorkerPool::get_executor() {
+    return pool.get_executor();
+  }
+
+  /**
+   * Get a snapshot of the pool statistics.
+   * @return Queue depth, task counters, queue wait times and run times.
+   */
+  WorkerPoolStats WorkerPool::get_stats() const {
+    return {
+      threads, capacity, pending.load(), submitted.load(), rejected.load(),
+      completed.load(), total_wait_us.load(), max_wait_us.load(), total_run_us.load(), max_run_us.load()
+    };
+  }
+
+  /**
+   * Stop the pool, abandoning any tasks that haven't started.
+   */
+  void WorkerPool::stop() {
+    pool.stop();
+  }
+
+  /**
+   * Wait for the pool threads to exit, after the tasks already queued have run or, once the
+   * pool is stopped, after the running ones have finished.
+   */
+  void WorkerPool::join() {
+    pool.join();
+  }
+
+  /**
+   * Initialize the global worker pool.
+   * @param threads Number of threads to run tasks on.
+   * @param capacity Maximum number of tasks waiting to start.
+   */
+  void init_worker_pool(size_t threads, size_t capacity) {
+    if (!global_worker_pool) {
+      global_worker_pool = new WorkerPool(threads, capacity);
+    }
+  }
+
+  /**
+   * Get the global worker pool.
+   * @return Global worker pool.
+   */
+  WorkerPool& get_worker_pool() {
+    if (!global_worker_pool) {
+      throw std::runtime_error("Worker pool not initialized. Call init_worker_pool first.");
+    }
+    return *global_worker_pool;
+  }
+
+  /**
+   * Initialize the global password pool, which verifies passwords with bcrypt.
+   * @param threads Number of threads to run bcrypt on.
+   * @param capacity Maximum number of verifications waiting to start.
+   */
+  void init_password_pool(size_t threads, size_t capacity) {
+    if (!global_password_pool) {
+      global_password_pool = new WorkerPool(threads, capacity);
+    }
+  }
+
+  /**
+   * Get the global password pool.
+   * @return Global password pool.
+   */
+  WorkerPool& get_password_pool() {
+    if (!global_password_pool) {
+      throw std::runtime_error("Password pool not initialized. Call init_password_pool first.");
+    }
+    return *global_password_pool;
+  }
+
+  /**
+   * Stop the worker and password pools and wait for their running tasks, on shutdown. Tasks
+   * still queue session writes, so this has to run before the session writer is stopped.
+   */
+  void stop_worker_pools() {
+    for (WorkerPool* pool : {global_worker_pool, global_password_pool}) {
+      if (pool) {
+        pool->stop();
+        pool->join();
+      }
+    }
+  }
+}
\ No newline at end of file
@@ -0,0 +1,156 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <utility>
+#include <boost/asio/thread_pool.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/async_result.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+namespace net = boost::asio;
+
+namespace server {
+  struct WorkerPoolStats {
+    size_t threads;
+    size_t capacity;
+    size_t queue_depth;
+    uint64_t submitted;
+    uint64_t rejected;
+    uint64_t completed;
+    uint64_t total_wait_us;
+    uint64_t max_wait_us;
+    uint64_t total_run_us;
+    uint64_t max_run_us;
+  };
+
+  /**
+   * Thrown from WorkerPool::run when the queue is full.
+   */
+  struct QueueFullError : std::runtime_error {
+    QueueFullError() : std::runtime_error("Worker queue is full") {}
+  };
+
+  /**
+   * Fixed-size thread pool with a bounded queue, used to keep blocking work off the I/O threads.
+   * Tasks are rejected rather than queued once capacity tasks are waiting to start.
+   */
+  class WorkerPool {
+  private:
+    net::thread_pool pool;
+    size_t threads;
+    size_t capacity;
+    std::atomic<size_t> pending;
+    std::atomic<uint64_t> submitted;
+    std::atomic<uint64_t> rejected;
+    std::atomic<uint64_t> completed;
+    std::atomic<uint64_t> total_wait_us;
+    std::atomic<uint64_t> max_wait_us;
+    std::atomic<uint64_t> total_run_us;
+    std::atomic<uint64_t> max_run_us;
+
+    void record_wait(std::chrono::steady_clock::time_point queued_at);
+    void record_run(std::chrono::steady_clock::time_point started_at);
+  public:
+    WorkerPool(size_t threads, size_t capacity);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Queue a task to run on the pool.
+     * @param task Task to run, exceptions thrown by it are logged and swallowed.
+     * @return 1 if the task was queued, 0 if the queue is full.
+     */
+    template <typename Task>
+    int submit(Task&& task) {
+      if (pending.fetch_add(1) >= capacity) {
+        pending.fetch_sub(1);
+        rejected++;
+        return 0;
+      }
+      submitted++;
+
+      auto queued_at = std::chrono::steady_clock::now();
+      net::post(pool, [this, queued_at, task = std::forward<Task>(task)]() mutable {
+        pending.fetch_sub(1);
+        record_wait(queued_at);
+        auto started_at = std::chrono::steady_clock::now();
+        try {
+          task();
+        } catch (const std::exception& e) {
+          std::cerr << "Uncaught exception in worker: " << e.what() << std::endl;
+        } catch (...) {
+          std::cerr << "Unknown exception in worker" << std::endl;
+        }
+        record_run(started_at);
+        completed++;
+      });
+      return 1;
+    }
+
+    /**
+     * Run a blocking function on the pool from a coroutine, resuming on the
+     * coroutine's executor once it finishes.
+     *
+     * @param function Function to run, its exceptions are rethrown in the coroutine.
+     * @return Result of the function.
+     * @throws QueueFullError if the queue is full.
+     */
+    template <typename Function>
+    net::awaitable<std::invoke_result_t<Function>> run(Function function) {
+      using Result = std::invoke_result_t<Function>;
+      auto executor = co_await net::this_coro::executor;
+      std::optional<Result> result;
+      std::exception_ptr error;
+
+      co_await net::async_initiate<const net::use_awaitable_t<>&, void()>(
+        [&](auto handler) {
+          // shared so the handler survives a rejected submit
+          auto resume = std::make_shared<decltype(handler)>(std::move(handler));
+          int queued = submit([&, executor, resume]() {
+            try {
+              result.emplace(function());
+            } catch (...) {
+              error = std::current_exception();
+            }
+            net::post(executor, std::move(*resume));
+          });
+
+          if (!queued) {
+            error = std::make_exception_ptr(QueueFullError());
+            net::post(executor, std::move(*resume));
+          }
+        }, net::use_awaitable);
+
+      if (error)
+        std::rethrow_exception(error);
+      co_return std::move(*result);
+    }
+
+    int admit();
+    net::thread_pool::executor_type get_executor();
+    WorkerPoolStats get_stats() const;
+    void stop();
+    void join();
+  };
+
+  void init_worker_pool(size_t threads, size_t capacity);
+  WorkerPool& get_worker_pool();
+  void init_password_pool(size_t threads, size_t capacity);
+  WorkerPool& get_password_pool();
+  void stop_worker_pools();
+}
+
+#endif
\ No newline at end of file